@@ -90,6 +90,9 @@ tween start_frame end_frame knoblist0 knoblist1
 
 frames num_frames	- How many frames to generate all together.
 
+resolution width height	- size of the generated images (default 500 500).
+			  Ignored when mdl is run with -r WxH.
+
 vary knob start_frame end_frame start_val end_val
 			- vary a knob from start_val to end_val over
 			  the course of start_frame to end_frame
@@ -104,14 +107,31 @@ light r g b x y z  	- creates a "light" datastructure with rgb values
 
 ambient r g b 		- specifies how much ambient light is in the scene
 
-constants name kar kdr ksr kag kdg ksg kab kdb ksb [r] [g] [b]
+			  Lights and ambient light apply to everything in
+			  the frame, wherever they appear in the script.
+			  With no lights, a white light at 1 1 1 is used.
+
+constants name kar kdr ksr kag kdg ksg kab kdb ksb [r] [g] [b] [exp]
 			- saves a set of lighting components in the
 			  symbol table under "name."
  			- r g b intensities can be specified. If not specified, they 
 			  default to 0.
+			- exp is the specular exponent, bigger is a smaller,
+			  sharper highlight. It defaults to 4 and must be
+			  positive.
+			- shapes without constants use ka 0.1, kd 0.5,
+			  ks 0.5 and exponent 4.
 
 shading wireframe|flat|gouraud|phong|raytrace
-			- set the shading mode
+			- set the shading mode for the objects drawn
+			  after it in the frame. flat (the default)
+			  fills each triangle with one lit color,
+			  wireframe only draws each visible edge once,
+			  gouraud lights each vertex and blends the
+			  colors across each triangle, phong blends
+			  the vertex normals instead and lights every
+			  pixel.
+			  Unsupported modes fall back to flat.
 
 
 MISC
@@ -126,7 +146,9 @@ camera eye aim		- establishes a camera. Eye and aim are
 
 
 save filename		- save the image in its current state under
-			  the name "filename."
+			  the name "filename." .png, .qoi and .ppm
+			  (or no extension) are written directly,
+			  other formats go through convert.
 
 gereate_rayfiles	- Instruct the interpreter to generate source
 			  files for a ray tracer for each frame rendered.
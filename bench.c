@@ -0,0 +1,397 @@
+/*========== bench.c ==========
+
+  Rasterizer benchmark, not part of mdl. Build and run with
+  $ make bench
+
+  Every workload is drawn twice: once through the generic
+  path (plot() per pixel, with the line octant re-tested per
+  pixel, which is how draw_line used to work) and once
+  through the specialized kernels in draw.c. Both runs draw
+  into their own screen and the results are compared, so a
+  speedup is only reported for identical images.
+
+  Every workload is run once per depth buffer format.
+
+  Saving a frame is compared the same way: the old text (P3)
+  writer against pack_rgb() and one write, both to
+  /dev/null. The packed bytes are checked against a plain
+  per value loop.
+
+  Phong shading has no old path to compare against, so it
+  is only timed: full screens of phong spans are lit with 1,
+  8 and 64 lights and the fill rate is reported in megapixels
+  per second.
+
+  Usage: ./bench [WxH]
+  =========================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "draw.h"
+#include "gmath.h"
+#include "lighting.h"
+#include "material.h"
+
+#define NUM_LINES 200000
+#define NUM_SPANS 400000
+#define ROUNDS 5
+#define PHONG_ROUNDS 10
+
+struct segment {
+  int x0, y0, x1, y1;
+  double z0, z1;
+};
+
+/*======== void generic_draw_line() ==========
+  The old general purpose Bresenham loop, kept here as the
+  baseline. It works out the octant up front but still
+  tests it (wide/tall and the sign of A) for every pixel.
+  ====================*/
+static void generic_draw_line(int x0, int y0, double z0,
+                              int x1, int y1, double z1,
+                              screen s, zbuffer zb, color c) {
+
+  int x, y, d, A, B;
+  int dy_east, dy_northeast, dx_east, dx_northeast, d_east, d_northeast;
+  int loop_start, loop_end;
+  double distance;
+  double z, dz;
+
+  int xt, yt;
+  if (x0 > x1) {
+    xt = x0;
+    yt = y0;
+    z = z0;
+    x0 = x1;
+    y0 = y1;
+    z0 = z1;
+    x1 = xt;
+    y1 = yt;
+    z1 = z;
+  }
+
+  x = x0;
+  y = y0;
+  A = 2 * (y1 - y0);
+  B = -2 * (x1 - x0);
+  int wide = 0;
+  int tall = 0;
+  if ( abs(x1 - x0) >= abs(y1 - y0) ) {
+    wide = 1;
+    loop_start = x;
+    loop_end = x1;
+    dx_east = dx_northeast = 1;
+    dy_east = 0;
+    d_east = A;
+    distance = x1 - x;
+    if ( A > 0 ) {
+      d = A + B/2;
+      dy_northeast = 1;
+      d_northeast = A + B;
+    }
+    else {
+      d = A - B/2;
+      dy_northeast = -1;
+      d_northeast = A - B;
+    }
+  }
+  else {
+    tall = 1;
+    dx_east = 0;
+    dx_northeast = 1;
+    distance = abs(y1 - y);
+    if ( A > 0 ) {
+      d = A/2 + B;
+      dy_east = dy_northeast = 1;
+      d_northeast = A + B;
+      d_east = B;
+      loop_start = y;
+      loop_end = y1;
+    }
+    else {
+      d = A/2 - B;
+      dy_east = dy_northeast = -1;
+      d_northeast = A - B;
+      d_east = -1 * B;
+      loop_start = y1;
+      loop_end = y;
+    }
+  }
+
+  z = z0;
+  dz = (z1 - z0) / distance;
+
+  while ( loop_start < loop_end ) {
+
+    plot( s, zb, c, x, y, z );
+    if ( (wide && ((A > 0 && d > 0) ||
+                   (A < 0 && d < 0)))
+         ||
+         (tall && ((A > 0 && d < 0 ) ||
+                   (A < 0 && d > 0) ))) {
+      y+= dy_northeast;
+      d+= d_northeast;
+      x+= dx_northeast;
+    }
+    else {
+      x+= dx_east;
+      y+= dy_east;
+      d+= d_east;
+    }
+    z+= dz;
+    loop_start++;
+  }
+  plot( s, zb, c, x1, y1, z );
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void random_segments(struct segment *segs, int n, int spans) {
+
+  int i;
+  for (i = 0; i < n; i++) {
+    //a quarter of everything hangs off the screen
+    segs[i].x0 = rand() % (xres + xres / 2) - xres / 4;
+    segs[i].y0 = rand() % (yres + yres / 2) - yres / 4;
+    segs[i].x1 = rand() % (xres + xres / 2) - xres / 4;
+    segs[i].y1 = spans ? segs[i].y0 : rand() % (yres + yres / 2) - yres / 4;
+    segs[i].z0 = rand() % 2000 - 1000 + rand() / (double)RAND_MAX;
+    segs[i].z1 = rand() % 2000 - 1000 + rand() / (double)RAND_MAX;
+  }
+}
+
+static color segment_color(int i) {
+  color c;
+  c.red = (23 * i) % 256;
+  c.green = (109 * i) % 256;
+  c.blue = (227 * i) % 256;
+  return c;
+}
+
+/*
+  Runs one workload through both paths. spans selects
+  draw_span as the specialized path, otherwise draw_line.
+  Returns 1 if the images matched.
+*/
+static int compare(char *label, struct segment *segs, int n, int spans) {
+
+  screen s0, s1;
+  zbuffer zb0, zb1;
+  double t, generic, specialized;
+  int i, r, match;
+
+  s0 = new_screen();
+  s1 = new_screen();
+  zb0 = new_zbuffer();
+  zb1 = new_zbuffer();
+  generic = specialized = 0;
+
+  for (r = 0; r < ROUNDS; r++) {
+    clear_screen(s0);
+    clear_zbuffer(zb0);
+    t = now();
+    for (i = 0; i < n; i++)
+      generic_draw_line(segs[i].x0, segs[i].y0, segs[i].z0,
+                        segs[i].x1, segs[i].y1, segs[i].z1,
+                        s0, zb0, segment_color(i));
+    generic+= now() - t;
+
+    clear_screen(s1);
+    clear_zbuffer(zb1);
+    t = now();
+    if (spans)
+      for (i = 0; i < n; i++)
+        draw_span(segs[i].x0, segs[i].x1, segs[i].y0,
+                  segs[i].z0, segs[i].z1, s1, zb1, segment_color(i));
+    else
+      for (i = 0; i < n; i++)
+        draw_line(segs[i].x0, segs[i].y0, segs[i].z0,
+                  segs[i].x1, segs[i].y1, segs[i].z1,
+                  s1, zb1, segment_color(i));
+    specialized+= now() - t;
+  }
+
+  match = !memcmp(s0, s1, (size_t)xres * yres * sizeof(color));
+  printf("%-8s generic %8.2f ms  specialized %8.2f ms  speedup %5.2fx  %s\n",
+         label, 1000 * generic / ROUNDS, 1000 * specialized / ROUNDS,
+         generic / specialized, match ? "images match" : "IMAGES DIFFER");
+
+  free_screen(s0);
+  free_screen(s1);
+  free_zbuffer(zb0);
+  free_zbuffer(zb1);
+  return match;
+}
+
+/*======== void generic_save_ppm() ==========
+  The old P3 writer, one fprintf per pixel.
+  ====================*/
+static void generic_save_ppm(screen s, FILE *f) {
+
+  int x, y;
+
+  fprintf(f, "P3\n%d %d\n%d\n", xres, yres, MAX_COLOR);
+  for ( y=0; y < yres; y++ ) {
+    for ( x=0; x < xres; x++)
+      fprintf(f, "%d %d %d ", s[y * xres + x].red,
+              s[y * xres + x].green, s[y * xres + x].blue);
+    fprintf(f, "\n");
+  }
+  fflush(f);
+}
+
+/*
+  Times writing a frame of noise (with some values out of
+  range, to exercise the clamping) through both writers.
+  Returns 1 if pack_rgb() got every byte right.
+*/
+static int compare_ppm() {
+
+  screen s;
+  unsigned char *rgb, head[64];
+  int *v;
+  size_t i, n;
+  double t, generic, specialized;
+  int r, fd, header, match;
+  FILE *f;
+
+  s = new_screen();
+  n = (size_t)xres * yres * 3;
+  v = (int *)s;
+  for (i = 0; i < n; i++)
+    v[i] = rand() % 300 - 20;
+  rgb = (unsigned char *)malloc(n + 64);
+  f = fopen("/dev/null", "w");
+  fd = open("/dev/null", O_WRONLY);
+  generic = specialized = 0;
+
+  for (r = 0; r < ROUNDS; r++) {
+    t = now();
+    generic_save_ppm(s, f);
+    generic+= now() - t;
+
+    t = now();
+    header = sprintf((char *)head, "P6\n%d %d\n%d\n", xres, yres, MAX_COLOR);
+    memcpy(rgb, head, header);
+    pack_rgb(s, rgb + header);
+    if (write(fd, rgb, header + n) < 0)
+      perror("write");
+    specialized+= now() - t;
+  }
+
+  match = 1;
+  for (i = 0; i < n; i++)
+    match&= rgb[header + i] == (v[i] < 0 ? 0 : v[i] > 255 ? 255 : v[i]);
+  printf("%-8s generic %8.2f ms  specialized %8.2f ms  speedup %5.2fx  %s\n",
+         "ppm", 1000 * generic / ROUNDS, 1000 * specialized / ROUNDS,
+         generic / specialized, match ? "bytes match" : "BYTES DIFFER");
+
+  fclose(f);
+  close(fd);
+  free(rgb);
+  free_screen(s);
+  return match;
+}
+
+/*
+  Fills the screen PHONG_ROUNDS times with phong spans lit
+  by num_lights lights. The normals sweep across a
+  hemisphere facing the viewer, like on a big sphere.
+*/
+static void phong_fill_rate(int num_lights) {
+
+  double light[MAX_LIGHTS][2][3];
+  double view[3] = {0, 0, 1};
+  double a0[4], a1[4], t;
+  color ambient = {50, 50, 50};
+  struct lighting l;
+  screen s;
+  zbuffer zb;
+  int i, r, y;
+
+  for (i = 0; i < num_lights; i++) {
+    light[i][LOCATION][0] = rand() % 200 - 100;
+    light[i][LOCATION][1] = rand() % 200 - 100;
+    light[i][LOCATION][2] = rand() % 100 + 1;
+    light[i][COLOR][RED] = 255 / num_lights;
+    light[i][COLOR][GREEN] = 200 / num_lights;
+    light[i][COLOR][BLUE] = 150 / num_lights;
+  }
+  init_lighting(&l);
+  setup_lights(&l, view, ambient, light, num_lights);
+  bind_material(&l, DEFAULT_MATERIAL);
+
+  s = new_screen();
+  zb = new_zbuffer();
+  t = 0;
+  for (r = 0; r < PHONG_ROUNDS; r++) {
+    clear_zbuffer(zb);
+    t-= now();
+    for (y = 0; y < yres; y++) {
+      a0[0] = a1[0] = 0;
+      a0[1] = -1;
+      a1[1] = 1;
+      a0[2] = a1[2] = 2.0 * y / yres - 1;
+      a0[3] = a1[3] = 0.25;
+      draw_phong_span(0, xres - 1, y, a0, a1, s, zb, &l);
+    }
+    t+= now();
+  }
+  printf("phong    %2d light%s %8.2f ms  %8.2f megapixels/sec\n",
+         num_lights, num_lights == 1 ? " " : "s", 1000 * t / PHONG_ROUNDS,
+         (double)xres * yres * PHONG_ROUNDS / t / 1e6);
+
+  free_screen(s);
+  free_zbuffer(zb);
+  free_lighting(&l);
+}
+
+int main(int argc, char **argv) {
+
+  struct segment *segs;
+  int width, height, ok;
+
+  if (argc > 1) {
+    if (sscanf(argv[1], "%dx%d", &width, &height) != 2) {
+      printf("Usage: %s [WxH]\n", argv[0]);
+      return 1;
+    }
+    set_resolution(width, height);
+  }
+  printf("%dx%d, %d rounds\n", xres, yres, ROUNDS);
+
+  segs = (struct segment *)malloc(NUM_SPANS * sizeof(struct segment));
+
+  ok = 1;
+  for (depth_format = DEPTH_FLOAT32; depth_format <= DEPTH_INT24;
+       depth_format++) {
+    printf("depth %s\n", depth_format == DEPTH_INT24 ? "int24" : "float32");
+    srand(66);
+    random_segments(segs, NUM_LINES, 0);
+    ok&= compare("lines", segs, NUM_LINES, 0);
+    random_segments(segs, NUM_SPANS, 1);
+    ok&= compare("spans", segs, NUM_SPANS, 1);
+  }
+
+  ok&= compare_ppm();
+
+  depth_format = DEPTH_FLOAT32;
+  init_materials();
+  phong_fill_rate(1);
+  phong_fill_rate(8);
+  phong_fill_rate(64);
+
+  free(segs);
+  return !ok;
+}
@@ -0,0 +1,313 @@
+/*====================== cache.c ========================
+Keys frames by what goes into them, and keeps finished
+frames by key so identical ones are only drawn once (see
+cache.h).
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+#include "symtab.h"
+#include "y.tab.h"
+#include "ml6.h"
+#include "display.h"
+#include "lighting.h"
+#include "cache.h"
+
+char *cache_directory = NULL;
+
+/*======== uint64_t hash_bytes() ==========
+Inputs:   uint64_t h
+         const void *p
+         size_t size
+Returns: h (FNV_OFFSET to start) with size bytes from p
+hashed into it, FNV-1a style
+====================*/
+uint64_t hash_bytes( uint64_t h, const void *p, size_t size ) {
+
+  const unsigned char *c = (const unsigned char *)p;
+  size_t i;
+
+  for ( i = 0; i < size; i++ ) {
+    h ^= c[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+//hashes a symbol by name and type, and what it holds if
+//that's a light or constants (values come from the knobs)
+static uint64_t hash_symbol( uint64_t h, SYMTAB *p ) {
+
+  if ( p == NULL )
+    return hash_bytes(h, "", 1);
+  h = hash_bytes(h, p->name, strlen(p->name) + 1);
+  h = hash_bytes(h, &p->type, sizeof(p->type));
+  if ( p->type == SYM_CONSTANTS )
+    h = hash_bytes(h, p->s.c, offsetof(struct constants, material) +
+                   sizeof(p->s.c->material));
+  else if ( p->type == SYM_LIGHT )
+    h = hash_bytes(h, p->s.l, sizeof(struct light));
+  return h;
+}
+
+//hashes a file's name and contents
+static uint64_t hash_file( uint64_t h, char *file ) {
+
+  unsigned char buffer[65536];
+  size_t n;
+  FILE *f;
+
+  h = hash_bytes(h, file, strlen(file) + 1);
+  f = fopen(file, "rb");
+  if ( f == NULL )
+    return h;
+  while ( (n = fread(buffer, 1, sizeof(buffer), f)) > 0 )
+    h = hash_bytes(h, buffer, n);
+  fclose(f);
+  return h;
+}
+
+/*======== uint64_t hash_program() ==========
+Inputs:
+Returns: a hash of everything the same in every frame that
+decides how frames look
+
+Goes through op[] hashing each command the renderer reads,
+with the fields it reads. Commands that only matter before
+drawing starts (frames, vary and so on) don't count, their
+effect is in the knobs. A new command that changes how a
+frame looks needs to be added here.
+====================*/
+uint64_t hash_program() {
+
+  uint64_t h = FNV_OFFSET;
+  int settings[5], i;
+
+  settings[0] = CACHE_VERSION;
+  settings[1] = xres;
+  settings[2] = yres;
+  settings[3] = depth_format;
+  settings[4] = light_cache_bits;
+  h = hash_bytes(h, settings, sizeof(settings));
+
+  for ( i = 0; i < lastop; i++ ) {
+    h = hash_bytes(h, &op[i].opcode, sizeof(op[i].opcode));
+    switch ( op[i].opcode ) {
+    case LIGHT:
+      h = hash_symbol(h, op[i].op.light.p);
+      break;
+    case AMBIENT:
+      h = hash_bytes(h, op[i].op.ambient.c, sizeof(op[i].op.ambient.c));
+      break;
+    case SPHERE:
+      h = hash_symbol(h, op[i].op.sphere.constants);
+      h = hash_bytes(h, op[i].op.sphere.d, sizeof(op[i].op.sphere.d));
+      h = hash_bytes(h, &op[i].op.sphere.r, sizeof(double));
+      break;
+    case TORUS:
+      h = hash_symbol(h, op[i].op.torus.constants);
+      h = hash_bytes(h, op[i].op.torus.d, sizeof(op[i].op.torus.d));
+      h = hash_bytes(h, &op[i].op.torus.r0, sizeof(double));
+      h = hash_bytes(h, &op[i].op.torus.r1, sizeof(double));
+      break;
+    case BOX:
+      h = hash_symbol(h, op[i].op.box.constants);
+      h = hash_bytes(h, op[i].op.box.d0, sizeof(op[i].op.box.d0));
+      h = hash_bytes(h, op[i].op.box.d1, sizeof(op[i].op.box.d1));
+      break;
+    case MESH:
+      h = hash_symbol(h, op[i].op.mesh.constants);
+      h = hash_file(h, op[i].op.mesh.name);
+      break;
+    case LINE:
+      h = hash_bytes(h, op[i].op.line.p0, sizeof(op[i].op.line.p0));
+      h = hash_bytes(h, op[i].op.line.p1, sizeof(op[i].op.line.p1));
+      break;
+    case MOVE:
+      h = hash_bytes(h, op[i].op.move.d, sizeof(op[i].op.move.d));
+      h = hash_symbol(h, op[i].op.move.p);
+      break;
+    case SCALE:
+      h = hash_bytes(h, op[i].op.scale.d, sizeof(op[i].op.scale.d));
+      h = hash_symbol(h, op[i].op.scale.p);
+      break;
+    case ROTATE:
+      h = hash_bytes(h, &op[i].op.rotate.axis, sizeof(double));
+      h = hash_bytes(h, &op[i].op.rotate.degrees, sizeof(double));
+      h = hash_symbol(h, op[i].op.rotate.p);
+      break;
+    case SHADING:
+      h = hash_symbol(h, op[i].op.shading.p);
+      break;
+    case SAVE:
+      h = hash_symbol(h, op[i].op.save.p);
+      break;
+    }
+  }
+  return h;
+}
+
+/*======== uint64_t frame_key() ==========
+Inputs:   uint64_t program
+         double *knobs
+         int count
+Returns: the key of a frame of the program hash_program()
+returned program for, with count knob values (one row of
+the knob table)
+====================*/
+uint64_t frame_key( uint64_t program, double *knobs, int count ) {
+
+  return hash_bytes(hash_bytes(FNV_OFFSET, &program, sizeof(program)),
+                    knobs, count * sizeof(double));
+}
+
+/*======== void open_frame_cache() ==========
+Inputs:
+Returns:
+Makes the cache directory, if the cache is on and it isn't
+there yet.
+====================*/
+void open_frame_cache() {
+
+  if ( cache_directory == NULL )
+    return;
+  mkdir(DIRECTORY_NAME, 0755);
+  if ( mkdir(cache_directory, 0755) < 0 && errno != EEXIST ) {
+    printf("Error: could not make %s: %s, not caching frames\n",
+           cache_directory, strerror(errno));
+    cache_directory = NULL;
+  }
+}
+
+//reads all of file into a new buffer, NULL if it can't
+static unsigned char *read_file( char *file, size_t *size ) {
+
+  unsigned char *data;
+  struct stat st;
+  ssize_t n;
+  size_t done;
+  int fd;
+
+  fd = open(file, O_RDONLY);
+  if ( fd < 0 )
+    return NULL;
+  if ( fstat(fd, &st) < 0 ) {
+    close(fd);
+    return NULL;
+  }
+  data = (unsigned char *)malloc(st.st_size ? st.st_size : 1);
+  for ( done = 0; done < (size_t)st.st_size; done+= n ) {
+    n = read(fd, data + done, st.st_size - done);
+    if ( n < 0 && errno == EINTR )
+      n = 0;
+    else if ( n <= 0 )
+      break;
+  }
+  close(fd);
+  if ( done < (size_t)st.st_size ) {
+    free(data);
+    return NULL;
+  }
+  *size = done;
+  return data;
+}
+
+//copies size bytes from data to file, by way of a temporary
+//file so nobody sees it half written. The temporary's name
+//is unique to this process and copy, since other threads
+//may be copying to the same file
+static void copy_to( char *file, unsigned char *data, size_t size ) {
+
+  static int copies = 0;
+  char tmp[512];
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d.%d", file, (int)getpid(),
+           __sync_fetch_and_add(&copies, 1));
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 )
+    return;
+  write_all(fd, data, size);
+  close(fd);
+  if ( rename(tmp, file) < 0 )
+    unlink(tmp);
+}
+
+/*======== int reuse_frame() ==========
+Inputs:   uint64_t key
+         char *file
+         screen s
+Returns: 1 if the frame with key was in the cache, 0 if it
+has to be drawn
+
+A cached frame is loaded into s, and file is replaced by a
+link to (or copy of) it. Anything in the cache that isn't
+a frame of this size is ignored.
+====================*/
+int reuse_frame( uint64_t key, char *file, screen s ) {
+
+  unsigned char *data, *rgb;
+  char path[512], head[64];
+  size_t size, i, n;
+  int header;
+
+  if ( cache_directory == NULL )
+    return 0;
+  snprintf(path, sizeof(path), "%s/%016llx", cache_directory,
+           (unsigned long long)key);
+  data = read_file(path, &size);
+  if ( data == NULL )
+    return 0;
+
+  n = (size_t)xres * yres;
+  header = sprintf(head, "P6\n%d %d\n%d\n", xres, yres, MAX_COLOR);
+  if ( size != header + n * 3 || memcmp(data, head, header) ) {
+    free(data);
+    return 0;
+  }
+  rgb = data + header;
+  for ( i = 0; i < n; i++, rgb+= 3 ) {
+    s[i].red = rgb[0];
+    s[i].green = rgb[1];
+    s[i].blue = rgb[2];
+  }
+
+  unlink(file);
+  if ( link(path, file) < 0 )
+    copy_to(file, data, size);
+  free(data);
+  return 1;
+}
+
+/*======== void store_frame() ==========
+Inputs:   uint64_t key
+         char *file
+Returns:
+Adds frame file, just saved, to the cache under key, unless
+the cache has it already.
+====================*/
+void store_frame( uint64_t key, char *file ) {
+
+  unsigned char *data;
+  char path[512];
+  size_t size;
+
+  if ( cache_directory == NULL )
+    return;
+  snprintf(path, sizeof(path), "%s/%016llx", cache_directory,
+           (unsigned long long)key);
+  if ( link(file, path) == 0 || errno == EEXIST )
+    return;
+  data = read_file(file, &size);
+  if ( data != NULL )
+    copy_to(path, data, size);
+  free(data);
+}
@@ -0,0 +1,48 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ml6.h"
+#include "display.h"
+
+/*
+  Frame cache. Every frame gets a key, a 64 bit FNV-1a hash
+  of everything its pixels depend on: the parts of the
+  program the renderer reads (with the symbols they use and
+  the contents of any mesh files), the resolution, depth
+  format and light cache, and the frame's knob values.
+  Frames with the same key come out the same.
+
+  The cache is off unless --cache names a directory for
+  it. Each saved frame is hard linked into that directory
+  under its key (or copied, if the directory is on another
+  file system). A frame whose key is there already, from
+  earlier in this run or from an earlier run, is loaded and
+  linked from it instead of drawn, so held poses and
+  static scenes are only drawn once, and an interrupted
+  render picks up where it stopped.
+
+  Only frames saved as files are cached, and frame files
+  are always replaced rather than rewritten, so the copy in
+  the cache is never changed. Nothing is ever removed from
+  the directory, so every change to a script leaves a full
+  set of frames behind; it's up to the user to clear it.
+*/
+//goes up when the renderer changes what a frame looks like
+#define CACHE_VERSION 1
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+extern char *cache_directory;
+
+uint64_t hash_bytes( uint64_t h, const void *p, size_t size );
+uint64_t hash_program();
+uint64_t frame_key( uint64_t program, double *knobs, int count );
+void open_frame_cache();
+int reuse_frame( uint64_t key, char *file, screen s );
+void store_frame( uint64_t key, char *file );
+
+#endif
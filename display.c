@@ -10,11 +10,176 @@ for red, green and blue respectively
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ml6.h"
 #include "display.h"
+#include "image.h"
+
+//bytes reserved in front of each framebuffer, keeps pixels 64-byte aligned
+#define FRAMEBUFFER_HEADER 64
+//huge page size when /proc/meminfo doesn't say
+#define HUGE_PAGE_DEFAULT (2 * 1024 * 1024)
+
+int xres = DEFAULT_XRES;
+int yres = DEFAULT_YRES;
+int depth_format = DEPTH_FLOAT32;
+
+/*======== void set_resolution() ==========
+Inputs:   int width
+         int height
+Returns:
+Sets the size of every screen and zbuffer allocated
+afterwards. Exits if the size is unusable.
+====================*/
+void set_resolution( int width, int height ) {
+
+  if ( width <= 0 || height <= 0 || width > MAX_RES || height > MAX_RES ) {
+    printf("Error: Invalid resolution %dx%d (max %dx%d)\n",
+           width, height, MAX_RES, MAX_RES);
+    exit(1);
+  }
+  xres = width;
+  yres = height;
+}
+
+/*======== void set_depth_format() ==========
+Inputs:   char *name
+Returns:
+Picks the zbuffer format, "float32" or "int24". Exits on
+anything else.
+====================*/
+void set_depth_format( char *name ) {
+
+  if ( !strcmp(name, "float32") )
+    depth_format = DEPTH_FLOAT32;
+  else if ( !strcmp(name, "int24") )
+    depth_format = DEPTH_INT24;
+  else {
+    printf("Error: Unknown depth format %s (float32 or int24)\n", name);
+    exit(1);
+  }
+}
+
+/*======== size_t huge_page_size() ==========
+Inputs:
+Returns: the size of an explicit huge page, from
+/proc/meminfo, or HUGE_PAGE_DEFAULT if it isn't listed
+====================*/
+static size_t huge_page_size() {
+
+  static size_t page = 0;
+  char line[128];
+  unsigned long kb;
+  FILE *f;
+
+  if ( page != 0 )
+    return page;
+  kb = 0;
+  f = fopen("/proc/meminfo", "r");
+  if ( f != NULL ) {
+    while ( fgets(line, sizeof(line), f) != NULL )
+      if ( sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 )
+        break;
+    fclose(f);
+  }
+  page = kb ? (size_t)kb * 1024 : HUGE_PAGE_DEFAULT;
+  return page;
+}
+
+/*======== void *alloc_framebuffer() ==========
+Inputs:   size_t size
+Returns: zeroed memory for a framebuffer of size bytes
+
+Framebuffers are big and long lived, so they are mapped
+directly instead of going through malloc. Explicit huge
+pages are tried first, with the mapping rounded up to a
+whole number of them, then transparent huge pages are
+requested for a regular mapping. The mapping size is kept
+in a header in front of the returned block so it can be
+unmapped later.
+====================*/
+static void *alloc_framebuffer( size_t size ) {
+
+  size_t total;
+  char *block = MAP_FAILED;
+
+  total = size + FRAMEBUFFER_HEADER;
+#ifdef MAP_HUGETLB
+  {
+    size_t page = huge_page_size();
+    size_t huge_total = (total + page - 1) / page * page;
+
+    block = mmap(NULL, huge_total, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if ( block != MAP_FAILED )
+      total = huge_total;
+  }
+#endif
+  if ( block == MAP_FAILED ) {
+    block = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if ( block != MAP_FAILED )
+      madvise(block, total, MADV_HUGEPAGE);
+#endif
+  }
+  if ( block == MAP_FAILED ) {
+    printf("Error: Cannot allocate %lu byte framebuffer: %s\n",
+           (unsigned long)size, strerror(errno));
+    exit(1);
+  }
+  *(size_t *)block = total;
+  return block + FRAMEBUFFER_HEADER;
+}
+
+static void free_framebuffer( void *p ) {
+
+  char *block;
+
+  if ( p == NULL )
+    return;
+  block = (char *)p - FRAMEBUFFER_HEADER;
+  if ( munmap(block, *(size_t *)block) < 0 )
+    printf("Error: Cannot free framebuffer: %s\n", strerror(errno));
+}
+
+/*======== screen new_screen() ==========
+Inputs:
+Returns: a cleared xres x yres screen
+====================*/
+screen new_screen() {
+
+  screen s = alloc_framebuffer((size_t)xres * yres * sizeof(color));
+  clear_screen(s);
+  return s;
+}
+
+void free_screen( screen s ) {
+  free_framebuffer(s);
+}
+
+/*======== zbuffer new_zbuffer() ==========
+Inputs:
+Returns: a cleared xres x yres zbuffer
+====================*/
+zbuffer new_zbuffer() {
+
+  zbuffer zb = alloc_framebuffer((size_t)xres * yres * sizeof(union depth));
+  clear_zbuffer(zb);
+  return zb;
+}
+
+void free_zbuffer( zbuffer zb ) {
+  free_framebuffer(zb);
+}
 
 
 /*======== void plot() ==========
@@ -24,19 +189,33 @@ Inputs:   screen s
          int y
 Returns:
 Sets the color at pixel x, y to the color represented by c
-Note that s[0][0] will be the upper left hand corner
+Note that s[0] will be the upper left hand corner
 of the screen.
-If you wish to change this behavior, you can change the indicies
-of s that get set. For example, using s[x][YRES-1-y] will have
-pixel 0, 0 located at the lower left corner of the screen
+The row is flipped (yres-1-y) so pixel 0, 0 is located
+at the lower left corner of the screen
 ====================*/
 void plot(screen s, zbuffer zb, color c, int x, int y, double z) {
-  int newy = YRES - 1 - y;
-  z = (int)(z * 1000) / 1000;
-  if ( x >= 0 && x < XRES && newy >=0 && newy < YRES &&
-       zb[x][newy] <= z ) {
-    s[x][newy] = c;
-    zb[x][newy] = z;
+  int newy = yres - 1 - y;
+  int i;
+  float zf;
+  unsigned int zq;
+
+  if ( x >= 0 && x < xres && newy >=0 && newy < yres ) {
+    i = newy * xres + x;
+    if ( depth_format == DEPTH_INT24 ) {
+      zq = depth_int24(z);
+      if ( zb[i].q <= zq ) {
+        s[i] = c;
+        zb[i].q = zq;
+      }
+    }
+    else {
+      zf = z;
+      if ( zb[i].f <= zf ) {
+        s[i] = c;
+        zb[i].f = zf;
+      }
+    }
   }
 }
 
@@ -47,7 +226,7 @@ Sets every color in screen s to black
 ====================*/
 void clear_screen( screen s ) {
 
-  int x, y;
+  int i;
   color c;
 
   /* c.red = 0; */
@@ -58,23 +237,168 @@ void clear_screen( screen s ) {
   c.green = 255;
   c.blue = 255;
 
-  for ( y=0; y < YRES; y++ )
-    for ( x=0; x < XRES; x++)
-      s[x][y] = c;
+  for ( i=0; i < xres * yres; i++ )
+    s[i] = c;
 }
 
 /*======== void clear_zbuffer() ==========
 Inputs:   zbuffer
 Returns:
-Sets all entries in the zbufffer to LONG_MIN
+Sets all entries in the zbufffer to the far value of the
+current depth format
 ====================*/
 void clear_zbuffer( zbuffer zb ) {
 
-  int x, y;
+  memset(zb, depth_format == DEPTH_INT24 ?
+         DEPTH_FAR_BYTE_INT24 : DEPTH_FAR_BYTE_FLOAT32,
+         (size_t)xres * yres * sizeof(union depth));
+}
+
+/*======== void copy_frame() ==========
+Inputs:   screen s
+         zbuffer zb
+         screen from
+         zbuffer from_zb
+Returns:
+Copies from and its depths over s and zb.
+====================*/
+void copy_frame( screen s, zbuffer zb, screen from, zbuffer from_zb ) {
+
+  memcpy(s, from, (size_t)xres * yres * sizeof(color));
+  memcpy(zb, from_zb, (size_t)xres * yres * sizeof(union depth));
+}
+
+/*======== void composite_frame() ==========
+Inputs:   screen s
+         zbuffer zb
+         screen from
+         zbuffer from_zb
+Returns:
+Lays from over s. Every pixel drawn in from (its depth
+isn't the cleared one) replaces the one in s if it is at
+least as close, the same test plot() does, so this is
+the same as drawing what went into from on s directly.
+====================*/
+void composite_frame( screen s, zbuffer zb, screen from, zbuffer from_zb ) {
+
+  union depth far;
+  size_t i, n;
+
+  memset(&far, depth_format == DEPTH_INT24 ?
+         DEPTH_FAR_BYTE_INT24 : DEPTH_FAR_BYTE_FLOAT32, sizeof(far));
+  n = (size_t)xres * yres;
+  for ( i = 0; i < n; i++ ) {
+    if ( from_zb[i].q == far.q )
+      continue;
+    if ( depth_format == DEPTH_INT24 ?
+         zb[i].q <= from_zb[i].q : zb[i].f <= from_zb[i].f ) {
+      s[i] = from[i];
+      zb[i] = from_zb[i];
+    }
+  }
+}
+
+/*======== void pack_rgb() ==========
+Inputs:   screen s
+         unsigned char *rgb
+Returns:
+Packs the int color triples of s into 3 bytes per pixel,
+row by row, clamping each value to 0-255. rgb needs room
+for xres * yres * 3 bytes.
+
+With SSE2, 4 pixels (12 ints) are packed per step with
+saturating packs. Each step stores 16 bytes of which the
+last 4 are overwritten by the next one, so the last
+pixels are done one at a time.
+====================*/
+void pack_rgb( screen s, unsigned char *rgb ) {
+
+  int *in = (int *)s;
+  size_t i, n;
+
+  n = (size_t)xres * yres * 3;
+  i = 0;
+#ifdef __SSE2__
+  __m128i a, b, c;
+  for ( ; i + 16 <= n; i+= 12 ) {
+    a = _mm_loadu_si128((__m128i *)(in + i));
+    b = _mm_loadu_si128((__m128i *)(in + i + 4));
+    c = _mm_loadu_si128((__m128i *)(in + i + 8));
+    a = _mm_packs_epi32(a, b);
+    c = _mm_packs_epi32(c, c);
+    _mm_storeu_si128((__m128i *)(rgb + i), _mm_packus_epi16(a, c));
+  }
+#endif
+  for ( ; i < n; i++ )
+    rgb[i] = in[i] < 0 ? 0 : in[i] > MAX_COLOR ? MAX_COLOR : in[i];
+}
+
+/*======== void write_all() ==========
+Inputs:   int fd
+         unsigned char *p
+         size_t size
+Returns:
+Writes size bytes from p to fd, with a single write unless
+the pipe or file takes less than all of it.
+====================*/
+void write_all( int fd, unsigned char *p, size_t size ) {
+
+  size_t done;
+  ssize_t n;
+
+  for ( done = 0; done < size; done+= n ) {
+    n = write(fd, p + done, size - done);
+    if ( n < 0 && errno == EINTR )
+      n = 0;
+    else if ( n <= 0 ) {
+      printf("Error: could not write image: %s\n", strerror(errno));
+      return;
+    }
+  }
+}
+
+//writes size bytes from p to a new file (a new one, so any
+//links to the old file, like the frame cache's, keep it)
+static void write_file( char *file, unsigned char *p, size_t size ) {
 
-  for ( y=0; y < YRES; y++ )
-    for ( x=0; x < XRES; x++)
-      zb[x][y] = LONG_MIN;
+  int fd;
+
+  unlink(file);
+  fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 ) {
+    printf("Error: could not open %s: %s\n", file, strerror(errno));
+    return;
+  }
+  write_all(fd, p, size);
+  close(fd);
+}
+
+/*======== void write_ppm() ==========
+Inputs:   int fd
+         screen s
+Returns:
+Writes s to fd as a binary (P6) ppm. The header and the
+packed pixels are put in one buffer, kept between calls,
+and written all at once.
+====================*/
+static void write_ppm( int fd, screen s ) {
+
+  static unsigned char *buffer = NULL;
+  static size_t buffer_size = 0;
+  size_t size;
+  int header;
+  char head[64];
+
+  header = sprintf(head, "P6\n%d %d\n%d\n", xres, yres, MAX_COLOR);
+  size = header + (size_t)xres * yres * 3;
+  if ( size > buffer_size ) {
+    free(buffer);
+    buffer = (unsigned char *)malloc(size);
+    buffer_size = size;
+  }
+  memcpy(buffer, head, header);
+  pack_rgb(s, buffer + header);
+  write_all(fd, buffer, size);
 }
 
 /*======== void save_ppm() ==========
@@ -82,22 +406,85 @@ Inputs:   screen s
          char *file
 Returns:
 Saves screen s as a valid ppm file using the
-settings in ml6.h
+settings in ml6.h. Like write_file(), this replaces file
+rather than writing over it.
 ====================*/
 void save_ppm( screen s, char *file) {
 
-  int x, y;
+  int fd;
+
+  unlink(file);
+  fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 ) {
+    printf("Error: could not open %s: %s\n", file, strerror(errno));
+    return;
+  }
+  write_ppm(fd, s);
+  close(fd);
+}
+
+/*======== char *file_extension() ==========
+Inputs:   char *file
+Returns: what follows the last . in the last part of file,
+or NULL if there is no extension
+====================*/
+static char *file_extension( char *file ) {
+
+  char *dot, *slash;
+
+  dot = strrchr(file, '.');
+  slash = strrchr(file, '/');
+  if ( dot == NULL || (slash != NULL && dot < slash) )
+    return NULL;
+  return dot + 1;
+}
+
+/*======== void save_rgb() ==========
+Inputs:   unsigned char *rgb
+         char *file
+         struct image_buffer *image
+Returns:
+Saves an xres x yres frame already packed by pack_rgb()
+to file, in the format its extension asks for. The
+encoded file is built in image, so as long as every
+thread has its own image buffer frames can be saved from
+several threads at once.
+
+.png and .qoi files are encoded here, as are .ppm files
+and files without an extension, which get a binary ppm.
+Any other extension is left to the "convert" command, if
+it is a format convert supports the image will be saved
+in that format.
+====================*/
+void save_rgb( unsigned char *rgb, char *file, struct image_buffer *image ) {
+
   FILE *f;
+  char line[256], head[64], *ext;
+  int header;
 
-  f = fopen(file, "w");
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
+  image->size = 0;
+  ext = file_extension(file);
+  if ( ext != NULL && !strcasecmp(ext, "png") )
+    encode_png(image, rgb, xres, yres);
+  else if ( ext != NULL && !strcasecmp(ext, "qoi") )
+    encode_qoi(image, rgb, xres, yres);
+  else {
+    header = sprintf(head, "P6\n%d %d\n%d\n", xres, yres, MAX_COLOR);
+    append_bytes(image, head, header);
+    append_bytes(image, rgb, (size_t)xres * yres * 3);
+  }
 
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
+  if ( ext == NULL || !strcasecmp(ext, "ppm") ||
+       !strcasecmp(ext, "png") || !strcasecmp(ext, "qoi") ) {
+    write_file(file, image->data, image->size);
+    return;
   }
-  fclose(f);
+
+  sprintf(line, "convert - %s", file);
+
+  f = popen(line, "w");
+  write_all(fileno(f), image->data, image->size);
+  pclose(f);
 }
 
 /*======== void save_extension() ==========
@@ -105,28 +492,30 @@ Inputs:   screen s
          char *file
 Returns:
 Saves the screen stored in s to the filename represented
-by file.
-If the extension for file is an image format supported
-by the "convert" command, the image will be saved in
-that format.
+by file, in the format its extension asks for (see
+save_rgb()). ppm files are packed straight into the
+buffer they are written from.
 ====================*/
 void save_extension( screen s, char *file) {
 
-  int x, y;
-  FILE *f;
-  char line[256];
-
-  sprintf(line, "convert - %s", file);
+  static struct image_buffer image = { NULL, 0, 0 };
+  static unsigned char *rgb = NULL;
+  static size_t rgb_size = 0;
+  char *ext;
 
-  f = popen(line, "w");
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
+  ext = file_extension(file);
+  if ( ext == NULL || !strcasecmp(ext, "ppm") ) {
+    save_ppm(s, file);
+    return;
+  }
 
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
+  if ( (size_t)xres * yres * 3 > rgb_size ) {
+    rgb_size = (size_t)xres * yres * 3;
+    free(rgb);
+    rgb = (unsigned char *)malloc(rgb_size);
   }
-  pclose(f);
+  pack_rgb(s, rgb);
+  save_rgb(rgb, file, &image);
 }
 
 
@@ -137,18 +526,10 @@ Will display the screen s on your monitor
 ====================*/
 void display( screen s) {
 
-  int x, y;
   FILE *f;
 
   f = popen("display", "w");
-
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
-
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
-  }
+  write_ppm(fileno(f), s);
   pclose(f);
 }
 
@@ -1,13 +1,58 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
+#include <stddef.h>
+
 #include "ml6.h"
 #define DIRECTORY_NAME "anim"
 
+struct image_buffer;
+
+/*
+  Depth buffer formats:
+  DEPTH_FLOAT32 - z as a float
+  DEPTH_INT24   - z in 24 bit fixed point with 8 fraction
+                  bits, offset so it is unsigned. Covers
+                  -32768 <= z < 32768, anything outside is
+                  clamped.
+  Both clear to a "far" value with a single memset: 0xfe
+  bytes make a float of about -1.7e38, and all real int24
+  depths are at least 1.
+*/
+#define DEPTH_FLOAT32 1
+#define DEPTH_INT24 2
+#define DEPTH_FAR_BYTE_FLOAT32 0xfe
+#define DEPTH_FAR_BYTE_INT24 0x00
+#define DEPTH_INT24_ONE 256
+#define DEPTH_INT24_MAX 0xffffff
+
+extern int depth_format;
+
+static inline unsigned int depth_int24( double z ) {
+  double q = z * DEPTH_INT24_ONE + (DEPTH_INT24_MAX / 2 + 1);
+  if ( q < 1 )
+    return 1;
+  if ( q > DEPTH_INT24_MAX )
+    return DEPTH_INT24_MAX;
+  return (unsigned int)q;
+}
+
+void set_resolution( int width, int height );
+void set_depth_format( char *name );
+screen new_screen();
+zbuffer new_zbuffer();
+void free_screen( screen s );
+void free_zbuffer( zbuffer zb );
+
 void plot(screen s, zbuffer zb, color c, int x, int y, double z);
 void clear_screen( screen s);
 void clear_zbuffer( zbuffer zb );
+void copy_frame( screen s, zbuffer zb, screen from, zbuffer from_zb );
+void composite_frame( screen s, zbuffer zb, screen from, zbuffer from_zb );
+void pack_rgb( screen s, unsigned char *rgb );
+void write_all( int fd, unsigned char *p, size_t size );
 void save_ppm( screen s, char *file);
+void save_rgb( unsigned char *rgb, char *file, struct image_buffer *image );
 void save_extension( screen s, char *file);
 void display( screen s);
 void make_animation( char * name );
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
 
 #include "ml6.h"
 #include "display.h"
@@ -10,109 +11,422 @@
 #include "gmath.h"
 #include "obj_reader.h"
 #include "mesh.h"
+#include "lighting.h"
+
+/*======== clipping ==========
+  Everything is clipped against the viewport before it is
+  rasterized, so nothing off screen is walked pixel by pixel.
+
+  Triangles that fall completely outside are thrown away.
+  Triangles that poke out but stay within GUARD_BAND pixels
+  of the screen are not clipped geometrically, their rows
+  and spans are clamped to the screen instead (cheap, and
+  keeps every pixel where it would have been). Only
+  triangles reaching past the guard band, where the integer
+  rasterizer would overflow, are really clipped.
+
+  Lines get the same treatment: clipped to the guard band
+  in doubles, then draw_line jumps its Bresenham state
+  straight to the first visible pixel.
+  ====================*/
+#define MAX_CLIPPED 7 //a triangle cut by 4 planes
+
+//vertices on their way to the rasterizer are x, y, z, then
+//red, green, blue for gouraud shading or the normal for phong
+#define VERTEX_SIZE 6
+#define ATTRIBUTES (VERTEX_SIZE - 2)
+
+//how fill_triangle() colors a triangle
+#define FILL_FLAT 0
+#define FILL_GOURAUD 1
+#define FILL_PHONG 2
+
+/*======== int clip_polygon() ==========
+  Inputs: double in[][VERTEX_SIZE], int n
+  double out[][VERTEX_SIZE]
+  int axis, double limit, int keep_above
+  Returns: number of vertices in out
+
+  One Sutherland-Hodgman pass: keeps the part of polygon
+  in on one side of axis == limit. Every part of a vertex
+  is interpolated along the cut edges.
+  ====================*/
+static int clip_polygon( double in[][VERTEX_SIZE], int n, double out[][VERTEX_SIZE],
+                         int axis, double limit, int keep_above ) {
+
+  int i, j, k, m, in_i, in_j;
+  double t;
+
+  m = 0;
+  for ( i = 0; i < n; i++ ) {
+    j = (i + 1) % n;
+    in_i = keep_above ? in[i][axis] >= limit : in[i][axis] <= limit;
+    in_j = keep_above ? in[j][axis] >= limit : in[j][axis] <= limit;
+    if ( in_i ) {
+      for ( k = 0; k < VERTEX_SIZE; k++ )
+        out[m][k] = in[i][k];
+      m++;
+    }
+    if ( in_i != in_j ) {
+      t = (limit - in[i][axis]) / (in[j][axis] - in[i][axis]);
+      for ( k = 0; k < VERTEX_SIZE; k++ )
+        out[m][k] = in[i][k] + t * (in[j][k] - in[i][k]);
+      out[m][axis] = limit;
+      m++;
+    }
+  }
+  return m;
+}
 
-/*======== void scanline_convert() ==========
-  Inputs: struct matrix *points
-  int i
+/*======== int clip_line() ==========
+  Inputs: double *x0, double *y0, double *z0
+  double *x1, double *y1, double *z1
+  Returns: 0 if the line misses the guard band entirely
+
+  Liang-Barsky clip of a line to the guard band rectangle,
+  the endpoints are moved in place.
+  ====================*/
+static int clip_line( double *x0, double *y0, double *z0,
+                      double *x1, double *y1, double *z1 ) {
+
+  double p[4], q[4], t0, t1, r, dx, dy, dz;
+  int i;
+
+  dx = *x1 - *x0;
+  dy = *y1 - *y0;
+  dz = *z1 - *z0;
+  p[0] = -dx; q[0] = *x0 + GUARD_BAND;
+  p[1] = dx;  q[1] = xres + GUARD_BAND - *x0;
+  p[2] = -dy; q[2] = *y0 + GUARD_BAND;
+  p[3] = dy;  q[3] = yres + GUARD_BAND - *y0;
+
+  t0 = 0;
+  t1 = 1;
+  for ( i = 0; i < 4; i++ ) {
+    if ( p[i] == 0 ) {
+      if ( q[i] < 0 )
+        return 0;
+    }
+    else {
+      r = q[i] / p[i];
+      if ( p[i] < 0 && r > t0 )
+        t0 = r;
+      else if ( p[i] > 0 && r < t1 )
+        t1 = r;
+    }
+  }
+  if ( t0 > t1 )
+    return 0;
+
+  if ( t1 < 1 ) {
+    *x1 = *x0 + t1 * dx;
+    *y1 = *y0 + t1 * dy;
+    *z1 = *z0 + t1 * dz;
+  }
+  if ( t0 > 0 ) {
+    *x0 = *x0 + t0 * dx;
+    *y0 = *y0 + t0 * dy;
+    *z0 = *z0 + t0 * dz;
+  }
+  return 1;
+}
+
+/*======== void draw_edge() ==========
+  Inputs: double x0, double y0, double z0
+  double x1, double y1, double z1
   screen s
   zbuffer zb
+  color c
   Returns:
-v
-  Fills in polygon i by drawing consecutive horizontal (or vertical) lines.
+  draw_line for unclipped (double) endpoints. Clips to the
+  guard band first so the int conversion is always safe.
+  ====================*/
+void draw_edge( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c ) {
 
-  Color should be set differently for each polygon.
+  if ( clip_line(&x0, &y0, &z0, &x1, &y1, &z1) )
+    draw_line(x0, y0, z0, x1, y1, z1, s, zb, c);
+}
+
+//per row steps of x and the attributes along the edge from p to q
+static void edge_steps( double *p, double *q, int distance, int attributes,
+                        double *dx, double *da ) {
+  int k;
+
+  *dx = distance > 0 ? (q[0] - p[0]) / distance : 0;
+  for ( k = 0; k < attributes; k++ )
+    da[k] = distance > 0 ? (q[2+k] - p[2+k]) / distance : 0;
+}
+
+/*======== void fill_triangle() ==========
+  Inputs: double v[3][VERTEX_SIZE]
+  int mode
+  screen s
+  zbuffer zb
+  color c
+  struct lighting *l
+  Returns:
+  Fills in the triangle v by drawing consecutive horizontal
+  lines. FILL_FLAT triangles are filled with c, FILL_GOURAUD
+  ones interpolate the vertex colors and FILL_PHONG ones
+  the vertex normals, which are lit per pixel with l. All
+  vertices have to be inside the guard band. Rows above and
+  below the screen are skipped without being walked.
   ====================*/
-void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color c) {
+static void fill_triangle( double v[3][VERTEX_SIZE], int mode,
+                           screen s, zbuffer zb, color c,
+                           struct lighting *l ) {
 
-  int top, mid, bot, y;
+  int top, mid, bot, y, ytop, ymid, skip, k;
   int distance0, distance1, distance2;
-  double x0, x1, y0, y1, y2, dx0, dx1, z0, z1, dz0, dz1;
+  double x0, x1, y0, y1, y2, dx0, dx1;
+  double a0[ATTRIBUTES], a1[ATTRIBUTES], da0[ATTRIBUTES], da1[ATTRIBUTES];
+  int attributes = mode == FILL_FLAT ? 1 : ATTRIBUTES;
   int flip = 0;
 
-  z0 = z1 = dz0 = dz1 = 0;
-
-  y0 = points->m[1][i];
-  y1 = points->m[1][i+1];
-  y2 = points->m[1][i+2];
-
-  /* color c; */
-  /* c.red = (23 * (i/3))%255; */
-  /* c.green = (109 * (i/3))%255; */
-  /* c.blue = (c.blue+(227 * (i/3)))%255; */
+  y0 = v[0][1];
+  y1 = v[1][1];
+  y2 = v[2][1];
 
   //find bot, mid, top
   if ( y0 <= y1 && y0 <= y2) {
-    bot = i;
+    bot = 0;
     if (y1 <= y2) {
-      mid = i+1;
-      top = i+2;
+      mid = 1;
+      top = 2;
     }
     else {
-      mid = i+2;
-      top = i+1;
+      mid = 2;
+      top = 1;
     }
   }//end y0 bottom
   else if (y1 <= y0 && y1 <= y2) {
-    bot = i+1;
+    bot = 1;
     if (y0 <= y2) {
-      mid = i;
-      top = i+2;
+      mid = 0;
+      top = 2;
     }
     else {
-      mid = i+2;
-      top = i;
+      mid = 2;
+      top = 0;
     }
   }//end y1 bottom
   else {
-    bot = i+2;
+    bot = 2;
     if (y0 <= y1) {
-      mid = i;
-      top = i+1;
+      mid = 0;
+      top = 1;
     }
     else {
-      mid = i+1;
-      top = i;
+      mid = 1;
+      top = 0;
     }
   }//end y2 bottom
-  //printf("ybot: %0.2f, ymid: %0.2f, ytop: %0.2f\n", (points->m[1][bot]),(points->m[1][mid]), (points->m[1][top]));
-  /* printf("bot: (%0.2f, %0.2f, %0.2f) mid: (%0.2f, %0.2f, %0.2f) top: (%0.2f, %0.2f, %0.2f)\n", */
-
-  x0 = points->m[0][bot];
-  x1 = points->m[0][bot];
-  z0 = points->m[2][bot];
-  z1 = points->m[2][bot];
-  y = (int)(points->m[1][bot]);
-
-  distance0 = (int)(points->m[1][top]) - y;
-  distance1 = (int)(points->m[1][mid]) - y;
-  distance2 = (int)(points->m[1][top]) - (int)(points->m[1][mid]);
 
-  //printf("distance0: %d distance1: %d distance2: %d\n", distance0, distance1, distance2);
-  dx0 = distance0 > 0 ? (points->m[0][top]-points->m[0][bot])/distance0 : 0;
-  dx1 = distance1 > 0 ? (points->m[0][mid]-points->m[0][bot])/distance1 : 0;
-  dz0 = distance0 > 0 ? (points->m[2][top]-points->m[2][bot])/distance0 : 0;
-  dz1 = distance1 > 0 ? (points->m[2][mid]-points->m[2][bot])/distance1 : 0;
+  x0 = v[bot][0];
+  x1 = v[bot][0];
+  for ( k = 0; k < attributes; k++ )
+    a0[k] = a1[k] = v[bot][2+k];
+  y = (int)(v[bot][1]);
+  ymid = (int)(v[mid][1]);
+  ytop = (int)(v[top][1]);
+
+  distance0 = ytop - y;
+  distance1 = ymid - y;
+  distance2 = ytop - ymid;
+
+  edge_steps(v[bot], v[top], distance0, attributes, &dx0, da0);
+  edge_steps(v[bot], v[mid], distance1, attributes, &dx1, da1);
+
+  //flat bottom, the first row already runs to mid
+  if ( distance1 == 0 ) {
+    flip = 1;
+    edge_steps(v[mid], v[top], distance2, attributes, &dx1, da1);
+    x1 = v[mid][0];
+    for ( k = 0; k < attributes; k++ )
+      a1[k] = v[mid][2+k];
+  }
 
-  while ( y <= (int)points->m[1][top] ) {
-    //printf("\tx0: %0.2f x1: %0.2f y: %d\n", x0, x1, y);
-    draw_line(x0, y, z0, x1, y, z1, s, zb, c);
+  //jump straight to the first row on screen
+  if ( y < 0 ) {
+    skip = -y;
+    y = 0;
+    x0+= skip * dx0;
+    for ( k = 0; k < attributes; k++ )
+      a0[k]+= skip * da0[k];
+    if ( y >= ymid ) {
+      flip = 1;
+      edge_steps(v[mid], v[top], distance2, attributes, &dx1, da1);
+      x1 = v[mid][0] + (y - ymid) * dx1;
+      for ( k = 0; k < attributes; k++ )
+        a1[k] = v[mid][2+k] + (y - ymid) * da1[k];
+    }
+    else {
+      x1+= skip * dx1;
+      for ( k = 0; k < attributes; k++ )
+        a1[k]+= skip * da1[k];
+    }
+  }
+  //and stop at the last one
+  if ( ytop >= yres )
+    ytop = yres - 1;
+
+  while ( y <= ytop ) {
+    if ( mode == FILL_GOURAUD )
+      draw_smooth_span(x0, x1, y, a0, a1, s, zb);
+    else if ( mode == FILL_PHONG )
+      draw_phong_span(x0, x1, y, a0, a1, s, zb, l);
+    else
+      draw_span(x0, x1, y, a0[0], a1[0], s, zb, c);
 
     x0+= dx0;
     x1+= dx1;
-    z0+= dz0;
-    z1+= dz1;
+    for ( k = 0; k < attributes; k++ ) {
+      a0[k]+= da0[k];
+      a1[k]+= da1[k];
+    }
     y++;
 
-    if ( !flip && y >= (int)(points->m[1][mid]) ) {
+    if ( !flip && y >= ymid ) {
       flip = 1;
-      dx1 = distance2 > 0 ? (points->m[0][top]-points->m[0][mid])/distance2 : 0;
-      dz1 = distance2 > 0 ? (points->m[2][top]-points->m[2][mid])/distance2 : 0;
-      x1 = points->m[0][mid];
-      z1 = points->m[2][mid];
+      edge_steps(v[mid], v[top], distance2, attributes, &dx1, da1);
+      x1 = v[mid][0];
+      for ( k = 0; k < attributes; k++ )
+        a1[k] = v[mid][2+k];
     }//end flip code
   }//end scanline loop
 }
 
+/*======== void rasterize_triangle() ==========
+  Inputs: double v[3][VERTEX_SIZE]
+  int mode
+  screen s
+  zbuffer zb
+  color c
+  struct lighting *l
+  Returns:
+  Triangles entirely off screen are rejected right away,
+  ones reaching past the guard band are clipped to it and
+  filled as a fan, the rest are filled as they are.
+  ====================*/
+static void rasterize_triangle( double v[MAX_CLIPPED][VERTEX_SIZE], int mode,
+                                screen s, zbuffer zb, color c,
+                                struct lighting *l ) {
+
+  double w[MAX_CLIPPED][VERTEX_SIZE], tri[3][VERTEX_SIZE];
+  double xmin, xmax, ymin, ymax;
+  int j, k, n;
+
+  xmin = xmax = v[0][0];
+  ymin = ymax = v[0][1];
+  for ( j = 1; j < 3; j++ ) {
+    xmin = v[j][0] < xmin ? v[j][0] : xmin;
+    xmax = v[j][0] > xmax ? v[j][0] : xmax;
+    ymin = v[j][1] < ymin ? v[j][1] : ymin;
+    ymax = v[j][1] > ymax ? v[j][1] : ymax;
+  }
+
+  //trivial reject, coordinates are truncated so (-1, 0) is still on screen
+  if ( xmax <= -1 || ymax <= -1 || xmin >= xres || ymin >= yres )
+    return;
+
+  if ( xmin >= -GUARD_BAND && xmax <= xres + GUARD_BAND &&
+       ymin >= -GUARD_BAND && ymax <= yres + GUARD_BAND ) {
+    fill_triangle(v, mode, s, zb, c, l);
+    return;
+  }
+
+  n = clip_polygon(v, 3, w, 0, -GUARD_BAND, 1);
+  n = clip_polygon(w, n, v, 0, xres + GUARD_BAND, 0);
+  n = clip_polygon(v, n, w, 1, -GUARD_BAND, 1);
+  n = clip_polygon(w, n, v, 1, yres + GUARD_BAND, 0);
+  for ( j = 1; j < n - 1; j++ ) {
+    for ( k = 0; k < VERTEX_SIZE; k++ ) {
+      tri[0][k] = v[0][k];
+      tri[1][k] = v[j][k];
+      tri[2][k] = v[j+1][k];
+    }
+    fill_triangle(tri, mode, s, zb, c, l);
+  }
+}
+
+/*======== void scanline_convert() ==========
+  Inputs: struct matrix *points
+  int i
+  screen s
+  zbuffer zb
+  Returns:
+
+  Fills in polygon i by drawing consecutive horizontal lines.
+
+  Color should be set differently for each polygon.
+  ====================*/
+void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color c) {
+
+  double v[MAX_CLIPPED][VERTEX_SIZE];
+  int j, k;
+
+  for ( j = 0; j < 3; j++ )
+    for ( k = 0; k < 3; k++ )
+      v[j][k] = points->m[k][i+j];
+  rasterize_triangle(v, FILL_FLAT, s, zb, c, NULL);
+}
+
+/*======== void scanline_gouraud() ==========
+  Inputs: struct matrix *points
+  int i
+  color *colors
+  screen s
+  zbuffer zb
+  Returns:
+
+  Fills in polygon i, blending the colors of its three
+  vertices across it.
+  ====================*/
+void scanline_gouraud( struct matrix *points, int i, color *colors,
+                       screen s, zbuffer zb ) {
+
+  double v[MAX_CLIPPED][VERTEX_SIZE];
+  int j, k;
+
+  for ( j = 0; j < 3; j++ ) {
+    for ( k = 0; k < 3; k++ )
+      v[j][k] = points->m[k][i+j];
+    v[j][3] = colors[j].red;
+    v[j][4] = colors[j].green;
+    v[j][5] = colors[j].blue;
+  }
+  rasterize_triangle(v, FILL_GOURAUD, s, zb, colors[0], NULL);
+}
+
+/*======== void scanline_phong() ==========
+  Inputs: struct matrix *points
+  int i
+  double normals[3][3]
+  screen s
+  zbuffer zb
+  struct lighting *l
+  Returns:
+
+  Fills in polygon i, interpolating the normals of its
+  three vertices and lighting every pixel with l.
+  ====================*/
+void scanline_phong( struct matrix *points, int i, double normals[3][3],
+                     screen s, zbuffer zb, struct lighting *l ) {
+
+  double v[MAX_CLIPPED][VERTEX_SIZE];
+  color c = {0, 0, 0};
+  int j, k;
+
+  for ( j = 0; j < 3; j++ )
+    for ( k = 0; k < 3; k++ ) {
+      v[j][k] = points->m[k][i+j];
+      v[j][3+k] = normals[j][k];
+    }
+  rasterize_triangle(v, FILL_PHONG, s, zb, c, l);
+}
+
 /*======== void add_polygon() ==========
   Inputs:   struct matrix *surfaces
   double x0
@@ -139,71 +453,542 @@ void add_polygon( struct matrix *polygons,
   add_point(polygons, x2, y2, z2);
 }
 
-/*======== void draw_polygons() ==========
+/*======== int parse_shading() ==========
+  Inputs:   char *name
+  Returns: the SHADE_ constant for a shading command argument
+
+  Modes that aren't implemented fall back to flat (with a
+  warning the first time).
+  ====================*/
+int parse_shading( char *name ) {
+
+  static int warned = 0;
+
+  if ( !strcmp(name, "wireframe") )
+    return SHADE_WIREFRAME;
+  if ( !strcmp(name, "gouraud") )
+    return SHADE_GOURAUD;
+  if ( !strcmp(name, "phong") )
+    return SHADE_PHONG;
+  if ( strcmp(name, "flat") && !warned ) {
+    printf("Warning: %s shading is not supported, using flat\n", name);
+    warned = 1;
+  }
+  return SHADE_FLAT;
+}
+
+/*
+  Edge set for wireframe mode. Neighbouring triangles share
+  edges, and a shared edge has the same (bitwise) endpoints
+  in both, so edges are keyed on their screen x, y with the
+  endpoints in a fixed order. The table is reused between
+  calls, entries from older calls are told apart by stamp.
+  Like the other scratch tables here, each thread drawing
+  frames has its own.
+*/
+struct edge_entry {
+  double x0, y0, x1, y1;
+  unsigned stamp;
+};
+
+static __thread struct edge_entry *edge_table = NULL;
+static __thread int edge_table_size = 0;
+static __thread unsigned edge_stamp = 0;
+
+static void reset_edges( int edges ) {
+
+  int size = 1024;
+
+  while ( size < edges * 2 )
+    size*= 2;
+  if ( size > edge_table_size ) {
+    free(edge_table);
+    edge_table = (struct edge_entry *)calloc(size, sizeof(struct edge_entry));
+    edge_table_size = size;
+    edge_stamp = 0;
+  }
+  edge_stamp++;
+}
+
+/*======== int add_unique_edge() ==========
+  Returns: 1 if the edge p -> q wasn't in the set yet
+  ====================*/
+static int add_unique_edge( double *p, double *q ) {
+
+  unsigned long long h, bits;
+  double k[4];
+  int i;
+
+  if ( p[0] < q[0] || (p[0] == q[0] && p[1] <= q[1]) ) {
+    k[0] = p[0]; k[1] = p[1]; k[2] = q[0]; k[3] = q[1];
+  }
+  else {
+    k[0] = q[0]; k[1] = q[1]; k[2] = p[0]; k[3] = p[1];
+  }
+
+  h = 1469598103934665603ULL;
+  for ( i = 0; i < 4; i++ ) {
+    memcpy(&bits, &k[i], sizeof(bits));
+    h = (h ^ bits) * 1099511628211ULL;
+  }
+
+  i = (h ^ (h >> 29)) & (edge_table_size - 1);
+  while ( edge_table[i].stamp == edge_stamp ) {
+    if ( edge_table[i].x0 == k[0] && edge_table[i].y0 == k[1] &&
+         edge_table[i].x1 == k[2] && edge_table[i].y1 == k[3] )
+      return 0;
+    i = (i + 1) & (edge_table_size - 1);
+  }
+  edge_table[i].x0 = k[0];
+  edge_table[i].y0 = k[1];
+  edge_table[i].x1 = k[2];
+  edge_table[i].y1 = k[3];
+  edge_table[i].stamp = edge_stamp;
+  return 1;
+}
+
+//(unnormalized) normal of triangle i, its length is twice the area
+static void face_normal( struct matrix *polygons, int i, double *n ) {
+
+  double a[3], b[3];
+  int k;
+
+  for ( k = 0; k < 3; k++ ) {
+    a[k] = polygons->m[k][i+1] - polygons->m[k][i];
+    b[k] = polygons->m[k][i+2] - polygons->m[k][i];
+  }
+  n[0] = a[1] * b[2] - a[2] * b[1];
+  n[1] = a[2] * b[0] - a[0] * b[2];
+  n[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+//normal of the triangle starting at point, out of faces
+static void face_of( struct matrix *faces, int point, double *n ) {
+  n[0] = faces->m[0][point / 3];
+  n[1] = faces->m[1][point / 3];
+  n[2] = faces->m[2][point / 3];
+}
+
+/*======== void draw_wireframe() ==========
   Inputs:   struct matrix *polygons
+  struct matrix *faces
   screen s
+  zbuffer zb
+  double *view
   color c
   Returns:
-  Goes through polygons 3 points at a time, drawing
-  lines connecting each points to create bounding
-  triangles. Compatible with multiple lights.  
-  ====================*/
-void draw_polygons(struct matrix *polygons, screen s, zbuffer zb,
-		   double *view, double light[MAX_LIGHTS][2][3],
-		   color ambient, double *areflect, double *dreflect,
-		   double *sreflect, int num_lights) {
-  if ( polygons->lastcol < 3 ) {
+  Draws every front facing edge once, no fill and no
+  lighting. The lines aren't z-buffered, so the zbuffer is
+  left alone.
+  ====================*/
+static void draw_wireframe( struct matrix *polygons, struct matrix *faces,
+                            screen s, zbuffer zb, double *view, color c ) {
+
+  int point, i, j, saved_depth;
+  double normal[3];
+  double v[3][3];
+
+  reset_edges(polygons->lastcol);
+  saved_depth = depth_test;
+  depth_test = 0;
+
+  for (point=0; point<polygons->lastcol-2; point+=3) {
+    face_of(faces, point, normal);
+    if (dot_product(normal, view) > 0) {
+      for ( i = 0; i < 3; i++ )
+        for ( j = 0; j < 3; j++ )
+          v[i][j] = polygons->m[j][point+i];
+      for ( i = 0; i < 3; i++ ) {
+        j = (i + 1) % 3;
+        if ( add_unique_edge(v[i], v[j]) )
+          draw_edge(v[i][0], v[i][1], v[i][2],
+                    v[j][0], v[j][1], v[j][2], s, zb, c);
+      }
+    }
+  }
+  depth_test = saved_depth;
+}
+
+/*
+  Vertex table. Triangles that share a vertex have it at
+  bitwise the same position, so vertices can be welded on
+  x, y, z. finish_shape() welds on position alone and has
+  each vertex sum the (area weighted) normals of the
+  triangles around it. Gouraud and phong mode weld on the
+  position and the normal, and only vertices of front
+  facing triangles are lit, once each, with their color (or
+  unit normal) kept in the entry. Same stamp scheme as the
+  edge set.
+*/
+struct vertex_entry {
+  double p[3];
+  double n[3];
+  color c;
+  int lit;
+  unsigned stamp;
+};
+
+static __thread struct vertex_entry *vertex_table = NULL;
+static __thread int vertex_table_size = 0;
+static __thread unsigned vertex_stamp = 0;
+
+static void reset_vertices( int vertices ) {
+
+  int size = 1024;
+
+  while ( size < vertices * 2 )
+    size*= 2;
+  if ( size > vertex_table_size ) {
+    free(vertex_table);
+    vertex_table = (struct vertex_entry *)calloc(size, sizeof(struct vertex_entry));
+    vertex_table_size = size;
+    vertex_stamp = 0;
+  }
+  vertex_stamp++;
+}
+
+/*======== int add_vertex() ==========
+  Returns: the table index of the vertex at p with normal
+  n, adding it if it isn't there yet. With n NULL vertices
+  are welded on position alone and start with no normal.
+  ====================*/
+static int add_vertex( double *p, double *n ) {
+
+  unsigned long long h, bits;
+  double k[6];
+  int i, size;
+
+  size = n ? 6 : 3;
+  memcpy(k, p, 3 * sizeof(double));
+  if ( n )
+    memcpy(k + 3, n, 3 * sizeof(double));
+
+  h = 1469598103934665603ULL;
+  for ( i = 0; i < size; i++ ) {
+    memcpy(&bits, &k[i], sizeof(bits));
+    h = (h ^ bits) * 1099511628211ULL;
+  }
+
+  i = (h ^ (h >> 29)) & (vertex_table_size - 1);
+  while ( vertex_table[i].stamp == vertex_stamp ) {
+    if ( !memcmp(vertex_table[i].p, k, 3 * sizeof(double)) &&
+         (n == NULL || !memcmp(vertex_table[i].n, k + 3, 3 * sizeof(double))) )
+      return i;
+    i = (i + 1) & (vertex_table_size - 1);
+  }
+  memcpy(vertex_table[i].p, k, 3 * sizeof(double));
+  if ( n )
+    memcpy(vertex_table[i].n, n, 3 * sizeof(double));
+  else
+    vertex_table[i].n[0] = vertex_table[i].n[1] = vertex_table[i].n[2] = 0;
+  vertex_table[i].lit = 0;
+  vertex_table[i].stamp = vertex_stamp;
+  return i;
+}
+
+//corner vertex, front facing flag and unlit vertex lists for draw_smooth()
+static __thread int *smooth_corners = NULL, *smooth_front = NULL;
+static __thread int *smooth_unlit = NULL;
+static __thread int smooth_points = 0;
+
+//the shape being drawn by draw_polygons(), after its transform
+static __thread struct shape *drawn = NULL;
+
+/*======== void draw_smooth() ==========
+  Inputs:   struct matrix *polygons
+  struct matrix *faces
+  struct matrix *normals
+  screen s
+  zbuffer zb
+  double *view
+  struct lighting *l
+  int phong
+  Returns:
+  Draws the front facing triangles of polygons with their
+  vertex colors blended across them, or with phong set,
+  their vertex normals blended across them and lit per
+  pixel. faces holds the normal of every triangle, normals
+  that of every point.
+  ====================*/
+static void draw_smooth( struct matrix *polygons, struct matrix *faces,
+                         struct matrix *normals, screen s, zbuffer zb,
+                         double *view, struct lighting *l, int phong ) {
+
+  float nx[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float ny[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float nz[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  color colors[LIGHT_BATCH], tri[3];
+  double p[3], n[3], fn[3], tn[3][3], m;
+  struct vertex_entry *e;
+  int *corners, *front, *unlit;
+  int point, i, j, k, num_front, num_unlit;
+
+  if ( polygons->lastcol > smooth_points ) {
+    smooth_points = polygons->lastcol;
+    smooth_corners = (int *)realloc(smooth_corners, smooth_points * sizeof(int));
+    smooth_front = (int *)realloc(smooth_front, smooth_points * sizeof(int));
+    smooth_unlit = (int *)realloc(smooth_unlit, smooth_points * sizeof(int));
+  }
+  corners = smooth_corners;
+  front = smooth_front;
+  unlit = smooth_unlit;
+  reset_vertices(polygons->lastcol);
+
+  //weld the vertices of front facing triangles
+  num_front = num_unlit = 0;
+  for (point=0; point<polygons->lastcol-2; point+=3) {
+    face_of(faces, point, fn);
+    if ( dot_product(fn, view) <= 0 )
+      continue;
+    front[num_front++] = point;
+    for ( j = 0; j < 3; j++ ) {
+      for ( k = 0; k < 3; k++ ) {
+        p[k] = polygons->m[k][point+j];
+        n[k] = normals->m[k][point+j];
+      }
+      corners[point+j] = add_vertex(p, n);
+      e = vertex_table + corners[point+j];
+      if ( !e->lit ) {
+        e->lit = 1;
+        unlit[num_unlit++] = corners[point+j];
+      }
+    }
+  }
+
+  //make every vertex normal that will be drawn unit length,
+  //and for gouraud light it, LIGHT_BATCH at a time
+  for ( i = 0; i < num_unlit; i+= LIGHT_BATCH ) {
+    k = num_unlit - i < LIGHT_BATCH ? num_unlit - i : LIGHT_BATCH;
+    for ( j = 0; j < k; j++ ) {
+      e = vertex_table + unlit[i+j];
+      m = sqrt(dot_product(e->n, e->n));
+      if ( m > 0 ) {
+        e->n[0]/= m;
+        e->n[1]/= m;
+        e->n[2]/= m;
+      }
+      else {
+        e->n[0] = view[0];
+        e->n[1] = view[1];
+        e->n[2] = view[2];
+      }
+      nx[j] = e->n[0];
+      ny[j] = e->n[1];
+      nz[j] = e->n[2];
+    }
+    if ( phong )
+      continue;
+    light_normals(l, nx, ny, nz, k, colors);
+    for ( j = 0; j < k; j++ )
+      vertex_table[unlit[i+j]].c = colors[j];
+  }
+
+  for ( i = 0; i < num_front; i++ ) {
+    point = front[i];
+    if ( phong ) {
+      for ( j = 0; j < 3; j++ )
+        memcpy(tn[j], vertex_table[corners[point+j]].n, sizeof(tn[j]));
+      scanline_phong(polygons, point, tn, s, zb, l);
+    }
+    else {
+      for ( j = 0; j < 3; j++ )
+        tri[j] = vertex_table[corners[point+j]].c;
+      scanline_gouraud(polygons, point, tri, s, zb);
+    }
+  }
+}
+
+/*======== struct shape *new_shape() ==========
+  Returns: an empty shape. Fill in its polygons (and its
+  normals, if there are any) then call finish_shape().
+  ====================*/
+struct shape *new_shape() {
+
+  struct shape *sh = (struct shape *)malloc(sizeof(struct shape));
+
+  sh->polygons = new_matrix(4, 100);
+  sh->faces = new_matrix(4, 100);
+  sh->normals = new_matrix(4, 100);
+  return sh;
+}
+
+void free_shape( struct shape *sh ) {
+  free_matrix(sh->polygons);
+  free_matrix(sh->faces);
+  free_matrix(sh->normals);
+  free(sh);
+}
+
+/*======== void free_draw_buffers() ==========
+  Inputs:
+  Returns:
+  Frees the scratch tables the drawing functions keep
+  between calls, the calling thread's copies. They are
+  made again if anything is drawn after.
+  ====================*/
+void free_draw_buffers() {
+
+  free(edge_table);
+  edge_table = NULL;
+  edge_table_size = 0;
+  free(vertex_table);
+  vertex_table = NULL;
+  vertex_table_size = 0;
+  free(smooth_corners);
+  free(smooth_front);
+  free(smooth_unlit);
+  smooth_corners = smooth_front = smooth_unlit = NULL;
+  smooth_points = 0;
+  if ( drawn != NULL )
+    free_shape(drawn);
+  drawn = NULL;
+}
+
+/*======== void finish_shape() ==========
+  Inputs:   struct shape *sh
+  Returns:
+  Works out the normal of every triangle of sh. Unless sh
+  already has a normal for every point, every point gets
+  the sum of the normals of the triangles around it. Both
+  are left unnormalized, as the length of a triangle's
+  normal is what weights it in the sum.
+  ====================*/
+void finish_shape( struct shape *sh ) {
+
+  struct matrix *polygons = sh->polygons;
+  double p[3], fn[3], *n;
+  int point, j, k, smooth;
+
+  smooth = sh->normals->lastcol != polygons->lastcol;
+  sh->faces->lastcol = 0;
+  if ( smooth ) {
+    sh->normals->lastcol = 0;
+    reset_vertices(polygons->lastcol);
+  }
+
+  for (point=0; point<polygons->lastcol-2; point+=3) {
+    face_normal(polygons, point, fn);
+    add_point(sh->faces, fn[0], fn[1], fn[2]);
+    if ( !smooth )
+      continue;
+    for ( j = 0; j < 3; j++ ) {
+      for ( k = 0; k < 3; k++ )
+        p[k] = polygons->m[k][point+j];
+      n = vertex_table[add_vertex(p, NULL)].n;
+      for ( k = 0; k < 3; k++ )
+        n[k]+= fn[k];
+    }
+  }
+
+  //the sums are only complete now
+  if ( smooth )
+    for (point=0; point<polygons->lastcol; point++) {
+      for ( k = 0; k < 3; k++ )
+        p[k] = polygons->m[k][point];
+      n = vertex_table[add_vertex(p, NULL)].n;
+      add_point(sh->normals, n[0], n[1], n[2]);
+    }
+}
+
+//b = the points of a, then transformed by m
+static void transform_points( struct matrix *m, struct matrix *a,
+                              struct matrix *b ) {
+
+  int r;
+
+  if ( b->cols < a->lastcol )
+    grow_matrix(b, a->lastcol);
+  for ( r = 0; r < 4; r++ )
+    memcpy(b->m[r], a->m[r], a->lastcol * sizeof(double));
+  b->lastcol = a->lastcol;
+  matrix_mult(m, b);
+}
+
+/*======== void draw_polygons() ==========
+  Inputs:   struct shape *sh
+  struct matrix *transform
+  screen s
+  zbuffer zb
+  struct lighting *l
+  int material
+  Returns:
+  Draws sh transformed by transform, 3 points at a time.
+  The points are transformed by transform itself, and the
+  triangle and vertex normals by its inverse transpose.
+  That keeps the normals pointing out of the shape even
+  when transform mirrors it, and makes backface culling a
+  dot product with the view vector.
+
+  In flat mode, each front facing triangle is lit once with
+  the lights set up in l and the given material, then
+  filled. In wireframe mode, only its edges are drawn.
+  Gouraud and phong mode light the vertex normals instead
+  of the triangle's.
+
+  Front facing triangles are collected LIGHT_BATCH at a
+  time so their normals can be shaded together, then filled
+  in their original order.
+  ====================*/
+void draw_polygons(struct shape *sh, struct matrix *transform,
+                   screen s, zbuffer zb,
+                   struct lighting *l, int material) {
+  if ( sh->polygons->lastcol < 3 ) {
     printf("Need at least 3 points to draw a polygon!\n");
     exit(0);
   }
 
-  int point;
-  double *normal;
+  struct matrix *polygons, *faces, *normal_transform;
+  double view[3] = { l->view[0], l->view[1], l->view[2] };
+
+  if ( drawn == NULL )
+    drawn = new_shape();
+  polygons = drawn->polygons;
+  faces = drawn->faces;
+  normal_transform = make_normal_matrix(transform);
+  transform_points(transform, sh->polygons, polygons);
+  transform_points(normal_transform, sh->faces, faces);
+  if ( shading == SHADE_GOURAUD || shading == SHADE_PHONG )
+    transform_points(normal_transform, sh->normals, drawn->normals);
+  free_matrix(normal_transform);
+
+  if ( shading == SHADE_WIREFRAME ) {
+    draw_wireframe(polygons, faces, s, zb, view, wireframe_color);
+    return;
+  }
+
+  float nx[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float ny[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float nz[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  int triangles[LIGHT_BATCH];
+  color colors[LIGHT_BATCH];
+  int point, i, n;
+  double normal[3];
+
+  bind_material(l, material);
+
+  if ( shading == SHADE_GOURAUD || shading == SHADE_PHONG ) {
+    draw_smooth(polygons, faces, drawn->normals, s, zb, view, l,
+                shading == SHADE_PHONG);
+    return;
+  }
+
+  n = 0;
   for (point=0; point<polygons->lastcol-2; point+=3) {
-    
-    normal = calculate_normal(polygons, point);
+
+    face_of(faces, point, normal);
     if (dot_product(normal, view) > 0) {
-      color c = {0, 0, 0};
-      
-      int i;
-      for(i=0; i<num_lights; i++) {
-        color new = get_lighting(normal, view, ambient, light[i], areflect, dreflect, sreflect);
-	
-	c.red += new.red;
-	c.green += new.green;
-	c.blue += new.blue;	
-      }
+      normalize(normal);
+      nx[n] = normal[0];
+      ny[n] = normal[1];
+      nz[n] = normal[2];
+      triangles[n++] = point;
+    }
 
-      if(c.red > 255)
-	c.red = 255;
-      if(c.green > 255)
-	c.green = 255;
-      if(c.blue > 255)
-	c.blue = 255;      
-      
-      scanline_convert(polygons, point, s, zb, c);
-
-      draw_line( polygons->m[0][point],
-                 polygons->m[1][point],
-                 polygons->m[2][point],
-                 polygons->m[0][point+1],
-                 polygons->m[1][point+1],
-                 polygons->m[2][point+1],
-                 s, zb, c);
-      draw_line( polygons->m[0][point+2],
-                 polygons->m[1][point+2],
-                 polygons->m[2][point+2],
-                 polygons->m[0][point+1],
-                 polygons->m[1][point+1],
-                 polygons->m[2][point+1],
-                 s, zb, c);
-      draw_line( polygons->m[0][point],
-                 polygons->m[1][point],
-                 polygons->m[2][point],
-                 polygons->m[0][point+2],
-                 polygons->m[1][point+2],
-                 polygons->m[2][point+2],
-                 s, zb, c);
+    if ( n == LIGHT_BATCH || (n && point + 3 >= polygons->lastcol-2) ) {
+      light_normals(l, nx, ny, nz, n, colors);
+      for (i=0; i < n; i++)
+        scanline_convert(polygons, triangles[i], s, zb, colors[i]);
+      n = 0;
     }
   }
 }
@@ -254,61 +1039,89 @@ void add_box( struct matrix * polygons,
   add_polygon(polygons, x, y1, z, x, y1, z1, x1, y1, z1);
 }//end add_box
 
-void add_mesh(struct matrix *polygons, char *fname) {
+/*======== void add_mesh() ==========
+  Inputs:   struct matrix *polygons
+  struct matrix *normals
+  char *fname
+  Returns:
+  Adds the triangles of OBJ file fname to polygons, quads
+  are split in two. If normals isn't NULL and the file has
+  a vn for every face corner, the normal of each point
+  added to polygons is added to normals, in the same order.
+  ====================*/
+void add_mesh(struct matrix *polygons, struct matrix *normals, char *fname) {
   struct mesh *mesh_conts = generate_mesh(fname);
 
-  struct matrix *pts, *face_order, *vert_norms;
+  struct matrix *pts, *face_order, *vert_norms, *face_norms;
 
   pts = mesh_conts->points;
   face_order = mesh_conts->face_ords;
   vert_norms = mesh_conts->vert_norms;
+  face_norms = mesh_conts->face_norms;
+  if (!mesh_conts->has_normals)
+    normals = NULL;
 
-  int i1, i2, i3, i4; // indices
-  double v1[3], v2[3], v3[3], v4[3]; // vertices
-  
-  int i;
+  // corners of each triangle, quads are 0 1 2 and 0 2 3
+  static int corners[2][3] = { {0, 1, 2}, {0, 2, 3} };
+  int i, t, c, v, n;
   
   // Iterate throughout face-order matrix and add polygons
   for(i=0; i<face_order->lastcol; i++) {
-    i1 = (face_order->m)[0][i];
-    i2 = (face_order->m)[1][i];
-    i3 = (face_order->m)[2][i];
-    i4 = (face_order->m)[3][i];
-
-    int coord;
-    for(coord=0; coord<3; coord++) {
-      if(i4 > 0) {
-	v1[coord] = (pts->m)[coord][i1-1];
-	v2[coord] = (pts->m)[coord][i2-1];
-	v3[coord] = (pts->m)[coord][i3-1];
-	v4[coord] = (pts->m)[coord][i4-1];
-      } else {	
-	v1[coord] = (pts->m)[coord][i1-1];
-	v2[coord] = (pts->m)[coord][i2-1];
-	v3[coord] = (pts->m)[coord][i3-1];
+    for(t=0; t < ((face_order->m)[3][i] > 0 ? 2 : 1); t++) {
+      for(c=0; c<3; c++) {
+	v = (face_order->m)[corners[t][c]][i] - 1;
+	add_point(polygons, (pts->m)[0][v], (pts->m)[1][v], (pts->m)[2][v]);
+	if (normals) {
+	  n = (face_norms->m)[corners[t][c]][i] - 1;
+	  add_point(normals, (vert_norms->m)[0][n], (vert_norms->m)[1][n],
+		    (vert_norms->m)[2][n]);
+	}
       }
     }
-
-    if(i4 > 0) {
-      add_polygon(polygons, v1[0], v1[1], v1[2], v2[0], v2[1], v2[2], v3[0], v3[1], v3[2]);
-      add_polygon(polygons, v1[0], v1[1], v1[2], v3[0], v3[1], v3[2], v4[0], v4[1], v4[2]);
-    } else {
-      add_polygon(polygons, v1[0], v1[1], v1[2], v2[0], v2[1], v2[2], v3[0], v3[1], v3[2]);
-    }
   }
-
-  free_mesh(mesh_conts);
 }
 
+/*
+  Parsed OBJ files, so each file is only read once no matter
+  how many frames or mesh commands use it
+*/
+struct mesh_cache_entry {
+  char *name;
+  struct mesh *mesh;
+  struct mesh_cache_entry *next;
+};
+
+static struct mesh_cache_entry *mesh_cache = NULL;
+
+/*======== struct mesh *generate_mesh() ==========
+  Inputs:   char *fname
+  Returns:  the mesh in OBJ file fname
+
+  The mesh is read the first time and kept after that,
+  callers must not free it.
+  ====================*/
 struct mesh *generate_mesh(char *fname) {
+  struct mesh_cache_entry *e;
+
+  for (e = mesh_cache; e != NULL; e = e->next)
+    if (!strcmp(e->name, fname))
+      return e->mesh;
+
   struct mesh *ret_mesh = (struct mesh *)malloc(sizeof(struct mesh));
   
   ret_mesh->points = new_matrix(4, 100);
   ret_mesh->face_ords = new_matrix(4, 100);
   ret_mesh->vert_norms = new_matrix(4, 100);
+  ret_mesh->face_norms = new_matrix(4, 100);
   
   read_obj_file(fname, ret_mesh);
 
+  e = (struct mesh_cache_entry *)malloc(sizeof(struct mesh_cache_entry));
+  e->name = strdup(fname);
+  e->mesh = ret_mesh;
+  e->next = mesh_cache;
+  mesh_cache = e;
+
   return ret_mesh;		      
 }
 
@@ -653,7 +1466,7 @@ void add_edge( struct matrix * points,
   screen s
   color c
   Returns:
-  Go through points 2 at a time and call draw_line to add that line
+  Go through points 2 at a time and call draw_edge to add that line
   to the screen
   ====================*/
 void draw_lines( struct matrix * points, screen s, zbuffer zb, color c) {
@@ -664,7 +1477,7 @@ void draw_lines( struct matrix * points, screen s, zbuffer zb, color c) {
   }
   int point;
   for (point=0; point < points->lastcol-1; point+=2)
-    draw_line( points->m[0][point],
+    draw_edge( points->m[0][point],
                points->m[1][point],
                points->m[2][point],
                points->m[0][point+1],
@@ -676,15 +1489,415 @@ void draw_lines( struct matrix * points, screen s, zbuffer zb, color c) {
 
 
 
+/*======== rasterization kernels ==========
+  The inner loops are stamped out once per depth mode and
+  line octant by the macros below, so the per pixel work
+  never re-tests anything that is fixed for the whole line
+  or span. draw_line() and draw_span() pick a kernel once
+  and hand it the precomputed steps.
+
+  Depth modes:
+  depth_float32, depth_int24 - z-buffered in that format,
+              the pixel is written if it is at least as close
+              as what is already there
+  depth_off - the pixel is always written and the zbuffer
+              is left alone (used for wireframe overlays)
+
+  Screen rows are flipped the same way plot() does it.
+  ====================*/
+__thread int depth_test = 1;
+__thread int shading = SHADE_FLAT;
+color wireframe_color = {0, 0, 0};
+
+#define WRITE_PIXEL_DEPTH_FLOAT32(s, zb, i, c, z) \
+  do {                                         \
+    float zf_ = (z);                           \
+    if ( (zb)[i].f <= zf_ ) {                  \
+      (s)[i] = (c);                            \
+      (zb)[i].f = zf_;                         \
+    }                                          \
+  } while (0)
+
+#define WRITE_PIXEL_DEPTH_INT24(s, zb, i, c, z) \
+  do {                                         \
+    unsigned int zq_ = depth_int24(z);         \
+    if ( (zb)[i].q <= zq_ ) {                  \
+      (s)[i] = (c);                            \
+      (zb)[i].q = zq_;                         \
+    }                                          \
+  } while (0)
+
+#define WRITE_PIXEL_DEPTH_OFF(s, zb, i, c, z)  \
+  do {                                         \
+    (void)(zb);                                \
+    (s)[i] = (c);                              \
+  } while (0)
+
+/*
+  Line kernels. x always moves left to right (draw_line swaps
+  the endpoints), so there are four octants:
+  1: shallow, going up     8: shallow, going down (or flat)
+  2: steep, going up       7: steep, going down
+  draw_line has already clipped the line, so the kernel just
+  walks n pixels starting at screen index i.
+*/
+#define DEFINE_LINE_KERNEL(NAME, WRITE, DX_E, DY_E, DX_NE, DY_NE, TAKE_NE) \
+  static void NAME( int i, double z, double dz, int n,                 \
+                    int d, int d_east, int d_northeast,                \
+                    screen s, zbuffer zb, color c ) {                  \
+    int di_east = DX_E - DY_E * xres;                                  \
+    int di_northeast = DX_NE - DY_NE * xres;                           \
+    while ( n-- > 0 ) {                                                \
+      WRITE(s, zb, i, c, z);                                           \
+      if ( TAKE_NE ) {                                                 \
+        i+= di_northeast;                                              \
+        d+= d_northeast;                                               \
+      }                                                                \
+      else {                                                           \
+        i+= di_east;                                                   \
+        d+= d_east;                                                    \
+      }                                                                \
+      z+= dz;                                                          \
+    }                                                                  \
+  }
+
+#define DEFINE_LINE_KERNELS(DEPTH, WRITE)                              \
+  DEFINE_LINE_KERNEL(line_octant1_##DEPTH, WRITE, 1, 0, 1, 1, d > 0)    \
+  DEFINE_LINE_KERNEL(line_octant8_##DEPTH, WRITE, 1, 0, 1, -1, d < 0)   \
+  DEFINE_LINE_KERNEL(line_octant2_##DEPTH, WRITE, 0, 1, 1, 1, d < 0)    \
+  DEFINE_LINE_KERNEL(line_octant7_##DEPTH, WRITE, 0, -1, 1, -1, d > 0)
+
+DEFINE_LINE_KERNELS(depth_off, WRITE_PIXEL_DEPTH_OFF)
+DEFINE_LINE_KERNELS(depth_float32, WRITE_PIXEL_DEPTH_FLOAT32)
+DEFINE_LINE_KERNELS(depth_int24, WRITE_PIXEL_DEPTH_INT24)
+
+typedef void (*line_kernel)( int i, double z, double dz, int n,
+                             int d, int d_east, int d_northeast,
+                             screen s, zbuffer zb, color c );
+
+#define OCTANT1 0
+#define OCTANT8 1
+#define OCTANT2 2
+#define OCTANT7 3
+
+//indexed by depth mode (0 for off, otherwise depth_format)
+static line_kernel line_kernels[3][4] = {
+  { line_octant1_depth_off, line_octant8_depth_off,
+    line_octant2_depth_off, line_octant7_depth_off },
+  { line_octant1_depth_float32, line_octant8_depth_float32,
+    line_octant2_depth_float32, line_octant7_depth_float32 },
+  { line_octant1_depth_int24, line_octant8_depth_int24,
+    line_octant2_depth_int24, line_octant7_depth_int24 }
+};
+
+#define DEPTH_MODE (depth_test ? depth_format : 0)
+
+/*
+  Span kernels fill one row from x0 to x1 (inclusive) with a
+  flat color. draw_span has already clamped the span to the
+  screen.
+*/
+#define DEFINE_SPAN_KERNEL(NAME, WRITE)                                \
+  static void NAME( int x0, int x1, int row, double z, double dz,      \
+                    screen s, zbuffer zb, color c ) {                  \
+    int i, end;                                                        \
+    end = row * xres + x1;                                             \
+    for ( i = row * xres + x0; i <= end; i++ ) {                       \
+      WRITE(s, zb, i, c, z);                                           \
+      z+= dz;                                                          \
+    }                                                                  \
+  }
+
+DEFINE_SPAN_KERNEL(span_flat_depth_off, WRITE_PIXEL_DEPTH_OFF)
+DEFINE_SPAN_KERNEL(span_flat_depth_float32, WRITE_PIXEL_DEPTH_FLOAT32)
+DEFINE_SPAN_KERNEL(span_flat_depth_int24, WRITE_PIXEL_DEPTH_INT24)
+
+typedef void (*span_kernel)( int x0, int x1, int row, double z, double dz,
+                             screen s, zbuffer zb, color c );
+
+static span_kernel span_kernels[3] = {
+  span_flat_depth_off, span_flat_depth_float32, span_flat_depth_int24
+};
+
+/*======== void draw_span() ==========
+  Inputs: int x0, int x1, int y
+  double z0, double z1
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+  Fills row y from x0 to x1, interpolating z. Draws the same
+  pixels as draw_line(x0, y, z0, x1, y, z1) would. The span
+  is clamped to the screen before it is handed to a kernel.
+  ====================*/
+void draw_span( int x0, int x1, int y, double z0, double z1,
+                screen s, zbuffer zb, color c ) {
+
+  int row, n;
+  double z, dz;
+
+  if ( x0 > x1 ) {
+    n = x0;
+    x0 = x1;
+    x1 = n;
+    z = z0;
+    z0 = z1;
+    z1 = z;
+  }
+
+  row = yres - 1 - y;
+  if ( row < 0 || row >= yres || x1 < 0 || x0 >= xres )
+    return;
+
+  n = x1 - x0;
+  dz = n > 0 ? (z1 - z0) / n : 0;
+  if ( x0 < 0 ) {
+    z0+= -x0 * dz;
+    x0 = 0;
+  }
+  if ( x1 >= xres )
+    x1 = xres - 1;
+
+  span_kernels[DEPTH_MODE](x0, x1, row, z0, dz, s, zb, c);
+}
+
+/*
+  Gouraud span kernels, same as the flat ones but a holds
+  z, red, green and blue, which all step by da per pixel.
+*/
+#define DEFINE_SMOOTH_SPAN_KERNEL(NAME, WRITE)                         \
+  static void NAME( int x0, int x1, int row, double *a, double *da,    \
+                    screen s, zbuffer zb ) {                           \
+    int i, end;                                                        \
+    double z = a[0], r = a[1], g = a[2], b = a[3];                     \
+    color c;                                                           \
+    end = row * xres + x1;                                             \
+    for ( i = row * xres + x0; i <= end; i++ ) {                       \
+      c.red = r;                                                       \
+      c.green = g;                                                     \
+      c.blue = b;                                                      \
+      WRITE(s, zb, i, c, z);                                           \
+      z+= da[0];                                                       \
+      r+= da[1];                                                       \
+      g+= da[2];                                                       \
+      b+= da[3];                                                       \
+    }                                                                  \
+  }
+
+DEFINE_SMOOTH_SPAN_KERNEL(span_smooth_depth_off, WRITE_PIXEL_DEPTH_OFF)
+DEFINE_SMOOTH_SPAN_KERNEL(span_smooth_depth_float32, WRITE_PIXEL_DEPTH_FLOAT32)
+DEFINE_SMOOTH_SPAN_KERNEL(span_smooth_depth_int24, WRITE_PIXEL_DEPTH_INT24)
+
+typedef void (*smooth_span_kernel)( int x0, int x1, int row,
+                                    double *a, double *da,
+                                    screen s, zbuffer zb );
+
+static smooth_span_kernel smooth_span_kernels[3] = {
+  span_smooth_depth_off, span_smooth_depth_float32, span_smooth_depth_int24
+};
+
+/*======== void draw_smooth_span() ==========
+  Inputs: int x0, int x1, int y
+  double *a0, double *a1
+  screen s
+  zbuffer zb
+  Returns:
+  draw_span for gouraud shading: a0 and a1 hold z, red,
+  green and blue at either end, all interpolated across.
+  ====================*/
+void draw_smooth_span( int x0, int x1, int y, double *a0, double *a1,
+                       screen s, zbuffer zb ) {
+
+  int row, n, k;
+  double a[4], da[4], *t;
+
+  if ( x0 > x1 ) {
+    n = x0;
+    x0 = x1;
+    x1 = n;
+    t = a0;
+    a0 = a1;
+    a1 = t;
+  }
+
+  row = yres - 1 - y;
+  if ( row < 0 || row >= yres || x1 < 0 || x0 >= xres )
+    return;
+
+  n = x1 - x0;
+  for ( k = 0; k < 4; k++ ) {
+    da[k] = n > 0 ? (a1[k] - a0[k]) / n : 0;
+    a[k] = a0[k];
+  }
+  if ( x0 < 0 ) {
+    for ( k = 0; k < 4; k++ )
+      a[k]+= -x0 * da[k];
+    x0 = 0;
+  }
+  if ( x1 >= xres )
+    x1 = xres - 1;
+
+  smooth_span_kernels[DEPTH_MODE](x0, x1, row, a, da, s, zb);
+}
+
+/*
+  Phong span kernels. a holds z and the normal, stepped by da
+  per pixel. Pixels are depth tested (and their depth
+  stored) as the span is walked, and only the interpolated
+  normals of visible pixels are gathered, LIGHT_BATCH at a
+  time, to be normalized and lit together.
+*/
+static inline int test_depth_float32( zbuffer zb, int i, double z ) {
+  float zf = z;
+  if ( zb[i].f > zf )
+    return 0;
+  zb[i].f = zf;
+  return 1;
+}
+
+static inline int test_depth_int24( zbuffer zb, int i, double z ) {
+  unsigned int zq = depth_int24(z);
+  if ( zb[i].q > zq )
+    return 0;
+  zb[i].q = zq;
+  return 1;
+}
+
+static inline int test_depth_off( zbuffer zb, int i, double z ) {
+  (void)zb;
+  (void)i;
+  (void)z;
+  return 1;
+}
+
+#define DEFINE_PHONG_SPAN_KERNEL(NAME, TEST)                           \
+  static void NAME( int x0, int x1, int row, double *a, double *da,    \
+                    screen s, zbuffer zb, struct lighting *l ) {       \
+    float nx[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));  \
+    float ny[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));  \
+    float nz[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));  \
+    color c[LIGHT_BATCH];                                              \
+    int at[LIGHT_BATCH];                                               \
+    int i, k, n, end;                                                  \
+    double z = a[0], x = a[1], y = a[2], w = a[3];                     \
+    end = row * xres + x1;                                             \
+    i = row * xres + x0;                                               \
+    while ( i <= end ) {                                               \
+      for ( n = 0; n < LIGHT_BATCH && i <= end; i++ ) {                \
+        if ( TEST(zb, i, z) ) {                                        \
+          at[n] = i;                                                   \
+          nx[n] = x;                                                   \
+          ny[n] = y;                                                   \
+          nz[n++] = w;                                                 \
+        }                                                              \
+        z+= da[0];                                                     \
+        x+= da[1];                                                     \
+        y+= da[2];                                                     \
+        w+= da[3];                                                     \
+      }                                                                \
+      for ( k = n; k % LIGHT_LANES; k++ )                              \
+        nx[k] = ny[k] = nz[k] = 0;                                     \
+      normalize_normals(nx, ny, nz, n);                                \
+      shade_normals(l, nx, ny, nz, n, c);                              \
+      for ( k = 0; k < n; k++ )                                        \
+        s[at[k]] = c[k];                                               \
+    }                                                                  \
+  }
+
+DEFINE_PHONG_SPAN_KERNEL(span_phong_depth_off, test_depth_off)
+DEFINE_PHONG_SPAN_KERNEL(span_phong_depth_float32, test_depth_float32)
+DEFINE_PHONG_SPAN_KERNEL(span_phong_depth_int24, test_depth_int24)
+
+typedef void (*phong_span_kernel)( int x0, int x1, int row,
+                                   double *a, double *da,
+                                   screen s, zbuffer zb,
+                                   struct lighting *l );
+
+static phong_span_kernel phong_span_kernels[3] = {
+  span_phong_depth_off, span_phong_depth_float32, span_phong_depth_int24
+};
+
+/*======== void draw_phong_span() ==========
+  Inputs: int x0, int x1, int y
+  double *a0, double *a1
+  screen s
+  zbuffer zb
+  struct lighting *l
+  Returns:
+  draw_span for phong shading: a0 and a1 hold z and the
+  normal at either end. The normal is interpolated across
+  and every pixel is lit with the material bound in l.
+  ====================*/
+void draw_phong_span( int x0, int x1, int y, double *a0, double *a1,
+                      screen s, zbuffer zb, struct lighting *l ) {
+
+  int row, n, k;
+  double a[4], da[4], *t;
+
+  if ( x0 > x1 ) {
+    n = x0;
+    x0 = x1;
+    x1 = n;
+    t = a0;
+    a0 = a1;
+    a1 = t;
+  }
+
+  row = yres - 1 - y;
+  if ( row < 0 || row >= yres || x1 < 0 || x0 >= xres )
+    return;
+
+  n = x1 - x0;
+  for ( k = 0; k < 4; k++ ) {
+    da[k] = n > 0 ? (a1[k] - a0[k]) / n : 0;
+    a[k] = a0[k];
+  }
+  if ( x0 < 0 ) {
+    for ( k = 0; k < 4; k++ )
+      a[k]+= -x0 * da[k];
+    x0 = 0;
+  }
+  if ( x1 >= xres )
+    x1 = xres - 1;
+
+  phong_span_kernels[DEPTH_MODE](x0, x1, row, a, da, s, zb, l);
+}
+
+//floor and ceiling of a / b for b > 0
+static long long floor_div( long long a, long long b ) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static long long ceil_div( long long a, long long b ) {
+  return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+/*======== void draw_line() ==========
+  Inputs: int x0, int y0, double z0
+  int x1, int y1, double z1
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+  Draws the line between (x0, y0) and (x1, y1) using
+  Bresenham's algorithm. The octant is worked out once
+  here, the per pixel loop lives in the line kernels.
+
+  Only the visible part of the line is walked. Written in
+  canonical form (P >= 0, Q < 0, D0 = P + Q/2) the decision
+  variable after k major and m minor steps is
+  D0 + k*P + m*Q, and it always stays in (P+Q, P]. That
+  pins m down for any k, so the state at the first visible
+  pixel can be computed directly, and so can the range of k
+  that keeps the minor axis on screen.
+  ====================*/
 void draw_line(int x0, int y0, double z0,
                int x1, int y1, double z1,
                screen s, zbuffer zb, color c) {
 
-
-  int x, y, d, A, B;
-  int dy_east, dy_northeast, dx_east, dx_northeast, d_east, d_northeast;
-  int loop_start, loop_end;
-  double distance;
+  int d, A, B, n, octant, sign, x, y;
+  int d_east, d_northeast;
+  long long kmin, kmax, lo, hi, m, P, Q, D0;
   double z, dz;
 
   //swap points if going right -> left
@@ -701,78 +1914,96 @@ void draw_line(int x0, int y0, double z0,
     z1 = z;
   }
 
-  x = x0;
-  y = y0;
   A = 2 * (y1 - y0);
   B = -2 * (x1 - x0);
-  int wide = 0;
-  int tall = 0;
   //octants 1 and 8
   if ( abs(x1 - x0) >= abs(y1 - y0) ) { //octant 1/8
-    wide = 1;
-    loop_start = x;
-    loop_end = x1;
-    dx_east = dx_northeast = 1;
-    dy_east = 0;
+    n = x1 - x0;
     d_east = A;
-    distance = x1 - x;
+    kmin = -x0;
+    kmax = xres - 1 - x0;
     if ( A > 0 ) { //octant 1
+      octant = OCTANT1;
+      sign = 1;
       d = A + B/2;
-      dy_northeast = 1;
       d_northeast = A + B;
+      lo = -y0;
+      hi = yres - 1 - y0;
     }
     else { //octant 8
+      octant = OCTANT8;
+      sign = -1;
       d = A - B/2;
-      dy_northeast = -1;
       d_northeast = A - B;
+      lo = y0 - (yres - 1);
+      hi = y0;
     }
   }//end octant 1/8
   else { //octant 2/7
-    tall = 1;
-    dx_east = 0;
-    dx_northeast = 1;
-    distance = abs(y1 - y);
+    n = abs(y1 - y0);
+    lo = -x0;
+    hi = xres - 1 - x0;
     if ( A > 0 ) {     //octant 2
+      octant = OCTANT2;
+      sign = -1;
       d = A/2 + B;
-      dy_east = dy_northeast = 1;
       d_northeast = A + B;
       d_east = B;
-      loop_start = y;
-      loop_end = y1;
+      kmin = -y0;
+      kmax = yres - 1 - y0;
     }
     else {     //octant 7
+      octant = OCTANT7;
+      sign = 1;
       d = A/2 - B;
-      dy_east = dy_northeast = -1;
       d_northeast = A - B;
       d_east = -1 * B;
-      loop_start = y1;
-      loop_end = y;
+      kmin = y0 - (yres - 1);
+      kmax = y0;
     }
   }
 
-  z = z0;
-  dz = (z1 - z0) / distance;
-  //printf("\t(%d, %d) -> (%d, %d)\tdistance: %0.2f\tdz: %0.2f\tz: %0.2f\n", x0, y0, x1, y1, distance, dz, z);
+  //visible range of k, the step along the major axis
+  kmin = kmin > 0 ? kmin : 0;
+  kmax = kmax < n ? kmax : n;
+  P = sign * d_east;
+  Q = sign * (d_northeast - d_east);
+  D0 = sign * d;
+  if ( P > 0 ) {
+    m = floor_div((lo - 1) * -Q - D0, P) + 2;
+    kmin = m > kmin ? m : kmin;
+    m = floor_div(hi * -Q - D0, P) + 1;
+    kmax = m < kmax ? m : kmax;
+  }
+  else if ( lo > 0 || hi < 0 ) //minor axis never moves
+    return;
+  if ( kmin > kmax )
+    return;
 
-  while ( loop_start < loop_end ) {
+  //jump to the first visible pixel
+  m = n > 0 ? ceil_div(D0 + (kmin - 1) * P, -Q) : 0;
+  d+= kmin * d_east + m * (d_northeast - d_east);
+  switch ( octant ) {
+  case OCTANT1:
+    x = x0 + kmin;
+    y = y0 + m;
+    break;
+  case OCTANT8:
+    x = x0 + kmin;
+    y = y0 - m;
+    break;
+  case OCTANT2:
+    x = x0 + m;
+    y = y0 + kmin;
+    break;
+  default:
+    x = x0 + m;
+    y = y0 - kmin;
+  }
 
-    plot( s, zb, c, x, y, z );
-    if ( (wide && ((A > 0 && d > 0) ||
-                   (A < 0 && d < 0)))
-         ||
-         (tall && ((A > 0 && d < 0 ) ||
-                   (A < 0 && d > 0) ))) {
-      y+= dy_northeast;
-      d+= d_northeast;
-      x+= dx_northeast;
-    }
-    else {
-      x+= dx_east;
-      y+= dy_east;
-      d+= d_east;
-    }
-    z+= dz;
-    loop_start++;
-  } //end drawing loop
-  plot( s, zb, c, x1, y1, z );
+  dz = n > 0 ? (z1 - z0) / n : 0;
+  z = kmin > 0 ? z0 + kmin * dz : z0;
+  line_kernels[DEPTH_MODE][octant]((yres - 1 - y) * xres + x, z, dz,
+                                   kmax - kmin + 1,
+                                   d, d_east, d_northeast, s, zb, c);
 } //end draw_line
@@ -3,18 +3,42 @@
 
 #include "matrix.h"
 #include "ml6.h"
-#include "lights.h"
+#include "lighting.h"
+
+//how far past the screen geometry may go before it is clipped
+#define GUARD_BAND 4096
 
 void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color c );
+void scanline_gouraud( struct matrix *points, int i, color *colors,
+                       screen s, zbuffer zb );
+void scanline_phong( struct matrix *points, int i, double normals[3][3],
+                     screen s, zbuffer zb, struct lighting *l );
+
+/*
+  A shape as built, before any transformation: its
+  triangles (3 points each), the normal of each triangle
+  and the normal of each point. Built once, then drawn
+  with draw_polygons() as often as needed.
+*/
+struct shape {
+  struct matrix *polygons;
+  struct matrix *faces;
+  struct matrix *normals;
+};
+
+struct shape *new_shape();
+void finish_shape( struct shape *sh );
+void free_shape( struct shape *sh );
+void free_draw_buffers();
 
 //polygon organization
 void add_polygons( struct matrix * points,
                    double x0, double y0, double z0,
                    double x1, double y1, double z1,
                    double x2, double y2, double z2);
-void draw_polygons( struct matrix * points, screen s, zbuffer zb,
-                    double *view, double light[MAX_LIGHTS][2][3], color ambient,
-                    double *areflect, double *dreflect, double *sreflect, int);
+void draw_polygons( struct shape *sh, struct matrix *transform,
+                    screen s, zbuffer zb,
+                    struct lighting *l, int material );
 
 //3d shapes
 void add_box( struct matrix * edges,
@@ -50,8 +74,32 @@ void draw_lines( struct matrix * points, screen s, zbuffer zb, color c);
 void draw_line(int x0, int y0, double z0,
                int x1, int y1, double z1,
                screen s, zbuffer zb, color c);
+void draw_edge( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c );
+void draw_span( int x0, int x1, int y, double z0, double z1,
+                screen s, zbuffer zb, color c );
+void draw_smooth_span( int x0, int x1, int y, double *a0, double *a1,
+                       screen s, zbuffer zb );
+void draw_phong_span( int x0, int x1, int y, double *a0, double *a1,
+                      screen s, zbuffer zb, struct lighting *l );
+
+//0 draws lines and spans without z-buffering. This and
+//shading are per thread, so threads drawing different
+//frames don't change each other's settings.
+extern __thread int depth_test;
+
+//shading modes, set by the shading command
+#define SHADE_WIREFRAME 0
+#define SHADE_FLAT 1
+#define SHADE_GOURAUD 2
+#define SHADE_PHONG 3
+
+extern __thread int shading;
+extern color wireframe_color;
+int parse_shading( char *name );
 
-void add_mesh(struct matrix *, char *);
+void add_mesh(struct matrix *, struct matrix *, char *);
 struct mesh *generate_mesh(char *);
 
 #endif
@@ -0,0 +1,396 @@
+/*====================== farm.c ========================
+Draws an animation's frames in worker processes, handing
+them out as the workers ask for more, and puts the results
+back in frame order (see farm.h for how it works).
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "display.h"
+#include "farm.h"
+
+int farm_workers = 0;
+
+/*======== void set_farm_workers() ==========
+Inputs:   int workers
+Returns:
+Sets how many worker processes draw frames. Exits if
+workers is out of range.
+====================*/
+void set_farm_workers( int workers ) {
+
+  if ( workers < 1 || workers > FARM_MAX_WORKERS ) {
+    printf("Error: Farm workers must be 1 to %d, not %d\n",
+           FARM_MAX_WORKERS, workers);
+    exit(1);
+  }
+  farm_workers = workers;
+}
+
+/*======== int read_all() ==========
+Inputs:   int fd
+         void *p
+         size_t size
+Returns: 1 if all size bytes were read into p, 0 if the
+other end closed or failed first
+====================*/
+static int read_all( int fd, void *p, size_t size ) {
+
+  unsigned char *c = (unsigned char *)p;
+  ssize_t n;
+
+  while ( size > 0 ) {
+    n = read(fd, c, size);
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      return 0;
+    c+= n;
+    size-= n;
+  }
+  return 1;
+}
+
+/*======== void send_message() ==========
+Inputs:   int fd
+         int type
+         int frame
+         size_t size
+Returns:
+Sends a message in one write. If the other end is gone it
+is ignored, the next read finds out.
+====================*/
+static void send_message( int fd, int type, int frame, size_t size ) {
+
+  struct farm_message m;
+
+  memset(&m, 0, sizeof(m));
+  m.type = type;
+  m.frame = frame;
+  m.size = size;
+  if ( write(fd, &m, sizeof(m)) != sizeof(m) )
+    return;
+}
+
+/*======== void start_worker() ==========
+Inputs:   struct farm *f
+         struct farm_worker *w
+Returns:
+Forks a new worker for w and connects it. The worker runs
+f->work until it is told to quit or loses the coordinator,
+and exits without running anything atexit() or flushing
+what it shares with the coordinator, like the animation.
+====================*/
+static void start_worker( struct farm *f, struct farm_worker *w ) {
+
+  int sv[2], i;
+
+  if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ) {
+    printf("Error: could not connect a worker: %s\n", strerror(errno));
+    exit(1);
+  }
+  fflush(stdout);
+  w->pid = fork();
+  if ( w->pid < 0 ) {
+    printf("Error: could not start a worker: %s\n", strerror(errno));
+    exit(1);
+  }
+  if ( w->pid == 0 ) {
+    close(sv[0]);
+    for ( i = 0; i < f->workers; i++ )
+      if ( f->worker[i].fd >= 0 )
+        close(f->worker[i].fd);
+    signal(SIGPIPE, SIG_DFL);
+    f->work(f->data, sv[1]);
+    fflush(stdout);
+    _exit(0);
+  }
+  close(sv[1]);
+  w->fd = sv[0];
+}
+
+/*======== void assign_frame() ==========
+Inputs:   struct farm *f
+         struct farm_worker *w
+Returns:
+Sends w the next frame of its run. Once its run is used
+up it gets a new one, the next chunk nobody has, or else
+the back half of the longest run left. With no frames left
+at all, w is told to quit.
+====================*/
+static void assign_frame( struct farm *f, struct farm_worker *w ) {
+
+  struct farm_worker *v;
+  int i, left, most, take;
+
+  if ( w->next > w->end ) {
+    if ( f->unassigned <= f->last ) {
+      w->next = f->unassigned;
+      w->end = w->next + f->chunk - 1;
+      if ( w->end > f->last )
+        w->end = f->last;
+      f->unassigned = w->end + 1;
+    }
+    else {
+      v = NULL;
+      most = 0;
+      for ( i = 0; i < f->workers; i++ ) {
+        left = f->worker[i].end - f->worker[i].next + 1;
+        if ( f->worker + i != w && f->worker[i].fd >= 0 && left > most ) {
+          v = f->worker + i;
+          most = left;
+        }
+      }
+      //v is busy with a frame, so even a run of one is worth taking
+      if ( v != NULL ) {
+        take = (most + 1) / 2;
+        w->end = v->end;
+        w->next = v->end - take + 1;
+        v->end = w->next - 1;
+      }
+    }
+  }
+
+  if ( w->next > w->end ) {
+    send_message(w->fd, FARM_QUIT, -1, 0);
+    close(w->fd);
+    w->fd = -1;
+    w->frame = -1;
+    return;
+  }
+  w->frame = w->next++;
+  send_message(w->fd, FARM_DRAW, w->frame, 0);
+}
+
+/*======== void finish_frame() ==========
+Inputs:   struct farm *f
+         int frame
+         unsigned char *rgb
+Returns:
+Marks frame done, with its pixels, or NULL if it has none
+or was skipped. Every frame done in order from the last one
+passed on now goes to the sink.
+====================*/
+static void finish_frame( struct farm *f, int frame, unsigned char *rgb ) {
+
+  int i;
+
+  f->done[frame - f->first] = 1;
+  f->pending[frame - f->first] = rgb;
+  while ( f->next_out <= f->last && f->done[f->next_out - f->first] ) {
+    i = f->next_out - f->first;
+    if ( f->sink != NULL && f->pending[i] != NULL )
+      f->sink(f->sink_data, f->next_out, f->pending[i]);
+    free(f->pending[i]);
+    f->pending[i] = NULL;
+    f->next_out++;
+  }
+}
+
+/*======== void lost_worker() ==========
+Inputs:   struct farm *f
+         struct farm_worker *w
+Returns:
+Cleans up after a worker that died or stopped making
+sense, and starts a new one on the rest of its run. The
+frame it was on is tried again first, unless that frame
+has now taken down FARM_RETRIES workers, in which case it
+is skipped.
+====================*/
+static void lost_worker( struct farm *f, struct farm_worker *w ) {
+
+  int status, tries;
+
+  close(w->fd);
+  w->fd = -1;
+  kill(w->pid, SIGKILL);
+  waitpid(w->pid, &status, 0);
+  if ( WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL )
+    printf("Worker %d died on frame %d (signal %d)\n",
+           (int)(w - f->worker), w->frame, WTERMSIG(status));
+  else
+    printf("Worker %d quit on frame %d\n", (int)(w - f->worker), w->frame);
+
+  tries = ++f->tries[w->frame - f->first];
+  if ( tries >= FARM_RETRIES ) {
+    printf("Error: Frame %d took down %d workers, skipping it\n",
+           w->frame, tries);
+    f->skipped++;
+    finish_frame(f, w->frame, NULL);
+  }
+  else
+    w->next = w->frame;
+
+  start_worker(f, w);
+  assign_frame(f, w);
+}
+
+/*======== void read_reply() ==========
+Inputs:   struct farm *f
+         struct farm_worker *w
+Returns:
+Reads w's answer for the frame it was sent, takes the
+frame, and gives w its next one. Anything but FARM_DONE
+for that frame, with the right amount of pixels, means w
+is lost.
+====================*/
+static void read_reply( struct farm *f, struct farm_worker *w ) {
+
+  struct farm_message m;
+  unsigned char *rgb = NULL;
+
+  if ( !read_all(w->fd, &m, sizeof(m)) || m.type != FARM_DONE ||
+       m.frame != w->frame ||
+       (m.size != 0 && m.size != f->frame_size) ) {
+    lost_worker(f, w);
+    return;
+  }
+  if ( m.size != 0 ) {
+    rgb = (unsigned char *)malloc(m.size);
+    if ( !read_all(w->fd, rgb, m.size) ) {
+      free(rgb);
+      lost_worker(f, w);
+      return;
+    }
+  }
+  finish_frame(f, m.frame, rgb);
+  assign_frame(f, w);
+}
+
+/*======== int run_farm() ==========
+Inputs:   int workers
+         int first
+         int last
+         farm_work work
+         void *data
+         size_t frame_size
+         frame_sink sink
+         void *sink_data
+Returns: how many frames were skipped
+
+Draws frames first to last on workers processes, forked
+from this one, so they start with everything it has. Each
+runs work with data and its end of the socket, and answers
+every frame with frame_size bytes of packed pixels, or
+none. sink, if not NULL, gets the pixels with sink_data, in
+frame order. Returns once every frame is done (or skipped)
+and every worker has exited.
+====================*/
+int run_farm( int workers, int first, int last, farm_work work, void *data,
+              size_t frame_size, frame_sink sink, void *sink_data ) {
+
+  struct farm f;
+  struct pollfd fds[FARM_MAX_WORKERS];
+  struct farm_worker *who[FARM_MAX_WORKERS];
+  void (*pipe_handler)(int);
+  int i, n, count;
+
+  count = last - first + 1;
+  if ( workers > count )
+    workers = count;
+
+  memset(&f, 0, sizeof(f));
+  f.workers = workers;
+  f.first = first;
+  f.last = last;
+  f.unassigned = first;
+  f.chunk = count / (workers * 4);
+  if ( f.chunk < 1 )
+    f.chunk = 1;
+  else if ( f.chunk > FARM_CHUNK )
+    f.chunk = FARM_CHUNK;
+  f.next_out = first;
+  f.tries = (int *)calloc(count, sizeof(int));
+  f.done = (char *)calloc(count, 1);
+  f.pending = (unsigned char **)calloc(count, sizeof(unsigned char *));
+  f.work = work;
+  f.data = data;
+  f.frame_size = frame_size;
+  f.sink = sink;
+  f.sink_data = sink_data;
+
+  //a worker that dies shows up as a failed read, not a signal here
+  pipe_handler = signal(SIGPIPE, SIG_IGN);
+
+  printf("Starting %d workers\n", workers);
+  for ( i = 0; i < workers; i++ ) {
+    f.worker[i].fd = -1;
+    f.worker[i].next = 0;
+    f.worker[i].end = -1;
+  }
+  for ( i = 0; i < workers; i++ ) {
+    start_worker(&f, f.worker + i);
+    assign_frame(&f, f.worker + i);
+  }
+
+  while ( f.next_out <= last ) {
+    n = 0;
+    for ( i = 0; i < workers; i++ )
+      if ( f.worker[i].fd >= 0 ) {
+        fds[n].fd = f.worker[i].fd;
+        fds[n].events = POLLIN;
+        who[n++] = f.worker + i;
+      }
+    if ( poll(fds, n, -1) < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      printf("Error: lost track of the workers: %s\n", strerror(errno));
+      exit(1);
+    }
+    for ( i = 0; i < n; i++ )
+      if ( fds[i].revents )
+        read_reply(&f, who[i]);
+  }
+
+  for ( i = 0; i < workers; i++ ) {
+    if ( f.worker[i].fd >= 0 ) {
+      send_message(f.worker[i].fd, FARM_QUIT, -1, 0);
+      close(f.worker[i].fd);
+    }
+    waitpid(f.worker[i].pid, NULL, 0);
+  }
+  signal(SIGPIPE, pipe_handler);
+
+  free(f.tries);
+  free(f.done);
+  free(f.pending);
+  return f.skipped;
+}
+
+/*======== int farm_next_frame() ==========
+Inputs:   int fd
+Returns: the next frame for this worker to draw, or -1 if
+it should quit
+====================*/
+int farm_next_frame( int fd ) {
+
+  struct farm_message m;
+
+  if ( !read_all(fd, &m, sizeof(m)) || m.type != FARM_DRAW )
+    return -1;
+  return m.frame;
+}
+
+/*======== void farm_frame_done() ==========
+Inputs:   int fd
+         int frame
+         unsigned char *rgb
+         size_t size
+Returns:
+Tells the coordinator frame is done (and saved), sending
+size bytes of its pixels from rgb along with it.
+====================*/
+void farm_frame_done( int fd, int frame, unsigned char *rgb, size_t size ) {
+
+  send_message(fd, FARM_DONE, frame, size);
+  if ( size != 0 )
+    write_all(fd, rgb, size);
+}
@@ -0,0 +1,84 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "queue.h"
+
+/*
+  Render farm: frames drawn by worker processes instead of
+  threads, so a worker that crashes (or leaks) only costs
+  the frame it was on.
+
+  The coordinator forks the workers once everything they
+  share is ready, and talks to each over its own Unix
+  socket, one frame at a time: it sends FARM_DRAW with a
+  frame, the worker draws and saves it and answers
+  FARM_DONE, with the packed pixels if the coordinator
+  asked for them. FARM_QUIT sends a worker home.
+
+  Each worker owns a run of frames and is handed them in
+  order. Runs are FARM_CHUNK frames or less, taken in frame
+  order. Once there are none left, a worker that runs out
+  takes the back half of the longest run someone else still
+  has. If a worker dies, a new one takes over its run,
+  starting with the frame it died on. A frame that kills
+  FARM_RETRIES workers is skipped.
+*/
+#define FARM_DRAW 1
+#define FARM_DONE 2
+#define FARM_QUIT 3
+
+#define FARM_MAX_WORKERS 64
+#define FARM_CHUNK 8
+#define FARM_RETRIES 3
+
+struct farm_message {
+  int type;
+  int frame;
+  //bytes of pixels after a FARM_DONE
+  size_t size;
+};
+
+struct farm_worker {
+  pid_t pid;
+  int fd;
+  //frame being drawn (-1 when idle), and the rest of its run
+  int frame;
+  int next, end;
+};
+
+//the worker's side: draws frames from fd until told to quit
+typedef void (*farm_work)( void *data, int fd );
+
+struct farm {
+  struct farm_worker worker[FARM_MAX_WORKERS];
+  int workers;
+  int first, last;
+  //runs start at unassigned, chunk frames at a time
+  int unassigned, chunk;
+
+  //per frame from first: workers lost on it, done yet,
+  //and its pixels while it waits for the ones before it
+  int *tries;
+  char *done;
+  unsigned char **pending;
+  int next_out, skipped;
+
+  farm_work work;
+  void *data;
+  size_t frame_size;
+  frame_sink sink;
+  void *sink_data;
+};
+
+extern int farm_workers;
+
+void set_farm_workers( int workers );
+int run_farm( int workers, int first, int last, farm_work work, void *data,
+              size_t frame_size, frame_sink sink, void *sink_data );
+int farm_next_frame( int fd );
+void farm_frame_done( int fd, int frame, unsigned char *rgb, size_t size );
+
+#endif
@@ -0,0 +1,378 @@
+/*====================== gif.c ========================
+Writes animated GIFs a frame at a time, so the animation is
+finished as soon as the last frame is rendered instead of
+being put together by convert from the saved frames.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gif.h"
+
+int gif_mode = GIF_DITHER;
+
+//levels of each channel in the palette, 6 * 7 * 6 = 252 colors
+#define RED_LEVELS 6
+#define GREEN_LEVELS 7
+#define BLUE_LEVELS 6
+
+//palette index of pixels that show the frame below
+#define GIF_TRANSPARENT 255
+
+//LZW codes are at most 12 bits, pixels are 8
+#define LZW_MIN_CODE_SIZE 8
+#define LZW_MAX_BITS 12
+#define LZW_CLEAR (1 << LZW_MIN_CODE_SIZE)
+#define LZW_END (LZW_CLEAR + 1)
+#define LZW_MAX_CODES (1 << LZW_MAX_BITS)
+#define LZW_HASH_SIZE 8192
+
+#define GIF_MAX_BLOCK 255
+
+//4x4 Bayer matrix, thresholds 0-15
+static const int bayer[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 }
+};
+
+/*======== void set_gif_mode() ==========
+Inputs:   char *name
+Returns:
+Picks how the animation is made, "dither", "fixed" or
+"convert". Exits on anything else.
+====================*/
+void set_gif_mode( char *name ) {
+
+  if ( !strcmp(name, "dither") )
+    gif_mode = GIF_DITHER;
+  else if ( !strcmp(name, "fixed") )
+    gif_mode = GIF_FIXED;
+  else if ( !strcmp(name, "convert") )
+    gif_mode = GIF_CONVERT;
+  else {
+    printf("Error: Unknown GIF mode %s (dither, fixed or convert)\n", name);
+    exit(1);
+  }
+}
+
+static void put_u16( unsigned char *p, int v ) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+/*======== void make_channel() ==========
+Inputs:   unsigned char table[16][256]
+         int levels
+         int weight
+         int dither
+Returns:
+Fills in the palette contribution (level * weight) of
+every value of a channel with levels levels, for each of
+the 16 dither thresholds. Without dither every threshold
+rounds to the nearest level.
+====================*/
+static void make_channel( unsigned char table[16][256], int levels,
+                          int weight, int dither ) {
+
+  int t, v, bias;
+
+  for ( t = 0; t < 16; t++ ) {
+    //threshold (t + 0.5) / 16 of a level, 8 / 16 rounds
+    bias = dither ? (2 * t + 1) * 255 : 16 * 255;
+    for ( v = 0; v < 256; v++ )
+      table[t][v] = (v * (levels - 1) * 32 + bias) / (255 * 32) * weight;
+  }
+}
+
+/*
+  LZW state, the same scheme as compress and the GIF
+  encoders that came from it: strings seen so far are kept
+  in a hash table from (prefix code, next pixel) to their
+  code.
+*/
+struct lzw {
+  struct image_buffer *out;
+  unsigned int bits;
+  int count;
+  int code_size;
+  int next_code;
+  int clear;
+  int keys[LZW_HASH_SIZE];
+  short codes[LZW_HASH_SIZE];
+};
+
+/*======== struct gif_writer *open_gif() ==========
+Inputs:   char *file
+         int width
+         int height
+         int delay
+Returns: a writer for an animation of width x height
+frames, delay hundredths of a second apart, or NULL if file
+can't be written
+
+Writes the header, the palette, and the extension that
+makes the animation loop forever.
+====================*/
+struct gif_writer *open_gif( char *file, int width, int height, int delay ) {
+
+  static const unsigned char loop[19] = {
+    0x21, 0xff, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+    3, 1, 0, 0, 0
+  };
+  struct gif_writer *g;
+  unsigned char header[13], palette[256][3];
+  int r, gr, b, i;
+  FILE *f;
+
+  f = fopen(file, "wb");
+  if ( f == NULL ) {
+    printf("Error: could not open %s\n", file);
+    return NULL;
+  }
+
+  g = (struct gif_writer *)calloc(1, sizeof(struct gif_writer));
+  g->f = f;
+  g->width = width;
+  g->height = height;
+  g->delay = delay;
+  g->indices = (unsigned char *)malloc((size_t)width * height);
+  g->previous = (unsigned char *)malloc((size_t)width * height);
+  g->pixels = (unsigned char *)malloc((size_t)width * height);
+  g->lzw = (struct lzw *)malloc(sizeof(struct lzw));
+  make_channel(g->red, RED_LEVELS, GREEN_LEVELS * BLUE_LEVELS,
+               gif_mode == GIF_DITHER);
+  make_channel(g->green, GREEN_LEVELS, BLUE_LEVELS, gif_mode == GIF_DITHER);
+  make_channel(g->blue, BLUE_LEVELS, 1, gif_mode == GIF_DITHER);
+
+  memcpy(header, "GIF89a", 6);
+  put_u16(header + 6, width);
+  put_u16(header + 8, height);
+  //global palette of 256 colors, 8 bits per channel
+  header[10] = 0xf7;
+  header[11] = 0;
+  header[12] = 0;
+
+  memset(palette, 0, sizeof(palette));
+  i = 0;
+  for ( r = 0; r < RED_LEVELS; r++ )
+    for ( gr = 0; gr < GREEN_LEVELS; gr++ )
+      for ( b = 0; b < BLUE_LEVELS; b++, i++ ) {
+        palette[i][0] = r * 255 / (RED_LEVELS - 1);
+        palette[i][1] = gr * 255 / (GREEN_LEVELS - 1);
+        palette[i][2] = b * 255 / (BLUE_LEVELS - 1);
+      }
+
+  fwrite(header, 1, sizeof(header), f);
+  fwrite(palette, 1, sizeof(palette), f);
+  fwrite(loop, 1, sizeof(loop), f);
+  return g;
+}
+
+/*======== void put_code() ==========
+Inputs:   struct lzw *z
+         int code
+Returns:
+Appends code, code_size bits wide, least significant bit
+first. Codes get a bit wider once the table has used up
+the current width, and go back to 9 bits after a clear.
+====================*/
+static void put_code( struct lzw *z, int code ) {
+
+  unsigned char byte;
+
+  z->bits|= code << z->count;
+  z->count+= z->code_size;
+  while ( z->count >= 8 ) {
+    byte = z->bits;
+    append_bytes(z->out, &byte, 1);
+    z->bits>>= 8;
+    z->count-= 8;
+  }
+
+  if ( z->clear ) {
+    z->code_size = LZW_MIN_CODE_SIZE + 1;
+    z->clear = 0;
+  }
+  else if ( z->next_code > (1 << z->code_size) - 1 &&
+            z->code_size < LZW_MAX_BITS )
+    z->code_size++;
+}
+
+static void clear_table( struct lzw *z ) {
+  memset(z->keys, -1, sizeof(z->keys));
+  z->next_code = LZW_END + 1;
+}
+
+/*======== void lzw_encode() ==========
+Inputs:   struct lzw *z
+         struct image_buffer *out
+         unsigned char *pixels
+         size_t n
+Returns:
+Appends the LZW codes for n pixels to out, packed into
+bytes but not yet split into blocks. The table is cleared
+whenever it fills up.
+====================*/
+static void lzw_encode( struct lzw *z, struct image_buffer *out,
+                        unsigned char *pixels, size_t n ) {
+
+  unsigned char byte;
+  int prefix, key, h;
+  size_t i;
+
+  z->out = out;
+  z->bits = 0;
+  z->count = 0;
+  z->code_size = LZW_MIN_CODE_SIZE + 1;
+  z->clear = 0;
+  clear_table(z);
+  put_code(z, LZW_CLEAR);
+
+  prefix = pixels[0];
+  for ( i = 1; i < n; i++ ) {
+    key = pixels[i] << LZW_MAX_BITS | prefix;
+    h = (key * 2654435761u) >> 19 & (LZW_HASH_SIZE - 1);
+    while ( z->keys[h] != -1 && z->keys[h] != key )
+      h = (h + 1) & (LZW_HASH_SIZE - 1);
+    if ( z->keys[h] == key ) {
+      prefix = z->codes[h];
+      continue;
+    }
+
+    put_code(z, prefix);
+    prefix = pixels[i];
+    if ( z->next_code < LZW_MAX_CODES ) {
+      z->keys[h] = key;
+      z->codes[h] = z->next_code++;
+    }
+    else {
+      clear_table(z);
+      z->clear = 1;
+      put_code(z, LZW_CLEAR);
+    }
+  }
+  put_code(z, prefix);
+  put_code(z, LZW_END);
+  if ( z->count > 0 ) {
+    byte = z->bits;
+    append_bytes(out, &byte, 1);
+  }
+}
+
+/*======== void add_gif_frame() ==========
+Inputs:   struct gif_writer *g
+         unsigned char *rgb
+Returns:
+Maps rgb (packed 8 bit RGB, width x height) to the palette
+and appends it to the animation. The first frame is
+written whole. After that only the rectangle around the
+pixels that changed is written, with the unchanged ones
+transparent, and the previous frame is left in place
+underneath. A frame with no changes is a single
+transparent pixel, so it still takes up its time.
+====================*/
+void add_gif_frame( struct gif_writer *g, unsigned char *rgb ) {
+
+  unsigned char head[18], *p, *swap;
+  int x, y, t, x0, y0, x1, y1, w, h, k;
+  size_t i, n;
+
+  for ( y = 0; y < g->height; y++ ) {
+    p = rgb + (size_t)y * g->width * 3;
+    i = (size_t)y * g->width;
+    for ( x = 0; x < g->width; x++, i++, p+= 3 ) {
+      t = bayer[y & 3][x & 3];
+      g->indices[i] = g->red[t][p[0]] + g->green[t][p[1]] + g->blue[t][p[2]];
+    }
+  }
+
+  x0 = y0 = 0;
+  x1 = g->width - 1;
+  y1 = g->height - 1;
+  if ( g->frames > 0 ) {
+    x0 = g->width;
+    y0 = g->height;
+    x1 = y1 = -1;
+    for ( y = 0; y < g->height; y++ ) {
+      i = (size_t)y * g->width;
+      for ( x = 0; x < g->width; x++, i++ )
+        if ( g->indices[i] != g->previous[i] ) {
+          x0 = x < x0 ? x : x0;
+          x1 = x > x1 ? x : x1;
+          y0 = y < y0 ? y : y0;
+          y1 = y;
+        }
+    }
+    if ( x1 < 0 )
+      x0 = x1 = y0 = y1 = 0;
+  }
+
+  w = x1 - x0 + 1;
+  h = y1 - y0 + 1;
+  n = 0;
+  for ( y = y0; y <= y1; y++ ) {
+    i = (size_t)y * g->width + x0;
+    for ( x = x0; x <= x1; x++, i++ )
+      g->pixels[n++] = g->frames > 0 && g->indices[i] == g->previous[i] ?
+        GIF_TRANSPARENT : g->indices[i];
+  }
+
+  //graphic control: leave the frame in place, delay, transparency
+  head[0] = 0x21;
+  head[1] = 0xf9;
+  head[2] = 4;
+  head[3] = 1 << 2 | (g->frames > 0);
+  put_u16(head + 4, g->delay);
+  head[6] = GIF_TRANSPARENT;
+  head[7] = 0;
+  //image descriptor, no local palette, then the LZW code size
+  head[8] = 0x2c;
+  put_u16(head + 9, x0);
+  put_u16(head + 11, y0);
+  put_u16(head + 13, w);
+  put_u16(head + 15, h);
+  head[17] = 0;
+
+  g->codes.size = 0;
+  lzw_encode(g->lzw, &g->codes, g->pixels, n);
+
+  g->out.size = 0;
+  append_bytes(&g->out, head, sizeof(head));
+  head[0] = LZW_MIN_CODE_SIZE;
+  append_bytes(&g->out, head, 1);
+  for ( i = 0; i < g->codes.size; i+= k ) {
+    k = g->codes.size - i < GIF_MAX_BLOCK ? g->codes.size - i : GIF_MAX_BLOCK;
+    head[0] = k;
+    append_bytes(&g->out, head, 1);
+    append_bytes(&g->out, g->codes.data + i, k);
+  }
+  head[0] = 0;
+  append_bytes(&g->out, head, 1);
+  fwrite(g->out.data, 1, g->out.size, g->f);
+
+  swap = g->previous;
+  g->previous = g->indices;
+  g->indices = swap;
+  g->frames++;
+}
+
+/*======== void close_gif() ==========
+Inputs:   struct gif_writer *g
+Returns:
+Ends the animation and frees g.
+====================*/
+void close_gif( struct gif_writer *g ) {
+
+  fputc(0x3b, g->f);
+  fclose(g->f);
+  free(g->lzw);
+  free(g->indices);
+  free(g->previous);
+  free(g->pixels);
+  free_image_buffer(&g->codes);
+  free_image_buffer(&g->out);
+  free(g);
+}
@@ -0,0 +1,60 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+/*
+  Animated GIF output, one frame at a time as they are
+  rendered. How the animation is made is picked with
+  set_gif_mode():
+  GIF_CONVERT - the old way, convert is run on the saved
+                frames once they are all written
+  GIF_FIXED   - every pixel gets the nearest color of a
+                fixed 6x7x6 (red, green, blue) palette
+  GIF_DITHER  - the same palette with 4x4 ordered
+                dithering, the default
+
+  The palette is the same for every frame, so a pixel that
+  doesn't change keeps its index. Every frame after the
+  first only covers the rectangle that changed, with the
+  unchanged pixels in it left transparent.
+*/
+#define GIF_CONVERT 0
+#define GIF_FIXED 1
+#define GIF_DITHER 2
+
+//hundredths of a second per frame
+#define GIF_DELAY 3
+
+struct lzw;
+
+struct gif_writer {
+  FILE *f;
+  int width, height;
+  int delay;
+  int frames;
+
+  //palette index of every pixel, this frame and last, and
+  //the pixels of the rectangle being written
+  unsigned char *indices, *previous, *pixels;
+
+  //palette contribution of each channel value, per
+  //dither threshold
+  unsigned char red[16][256], green[16][256], blue[16][256];
+
+  //LZW table, the frame's codes and the frame as written
+  struct lzw *lzw;
+  struct image_buffer codes;
+  struct image_buffer out;
+};
+
+extern int gif_mode;
+
+void set_gif_mode( char *name );
+struct gif_writer *open_gif( char *file, int width, int height, int delay );
+void add_gif_frame( struct gif_writer *g, unsigned char *rgb );
+void close_gif( struct gif_writer *g );
+
+#endif
@@ -0,0 +1,501 @@
+/*====================== image.c ========================
+PNG and QOI encoders for saving frames without convert.
+
+Both work on packed 8 bit RGB, row by row from the top, and
+only allocate through the image_buffer they write to (and,
+for PNG, one scratch copy of the filtered rows), so they are
+safe to run on several frames at once.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+int png_deflate = PNG_FAST;
+
+//LZ77 window and match limits, and the size of the match table
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_STORED 65535
+
+//most bytes Adler-32 can sum before its mod without overflowing
+#define ADLER_CHUNK 5552
+#define ADLER_MOD 65521
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_MAX_RUN 62
+
+/*======== void set_png_deflate() ==========
+Inputs:   char *name
+Returns:
+Picks the PNG compression, "stored" or "fast". Exits on
+anything else.
+====================*/
+void set_png_deflate( char *name ) {
+
+  if ( !strcmp(name, "stored") )
+    png_deflate = PNG_STORED;
+  else if ( !strcmp(name, "fast") )
+    png_deflate = PNG_FAST;
+  else {
+    printf("Error: Unknown PNG compression %s (stored or fast)\n", name);
+    exit(1);
+  }
+}
+
+void free_image_buffer( struct image_buffer *b ) {
+  free(b->data);
+  b->data = NULL;
+  b->size = b->capacity = 0;
+}
+
+//makes room for n more bytes
+void reserve_bytes( struct image_buffer *b, size_t n ) {
+
+  if ( b->size + n <= b->capacity )
+    return;
+  b->capacity = b->capacity * 2 > b->size + n ? b->capacity * 2 : b->size + n;
+  b->data = (unsigned char *)realloc(b->data, b->capacity);
+}
+
+void append_bytes( struct image_buffer *b, const void *p, size_t n ) {
+  reserve_bytes(b, n);
+  memcpy(b->data + b->size, p, n);
+  b->size+= n;
+}
+
+static void put_u32( unsigned char *p, unsigned int v ) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void put_u32_be( struct image_buffer *b, unsigned int v ) {
+  reserve_bytes(b, 4);
+  put_u32(b->data + b->size, v);
+  b->size+= 4;
+}
+
+/*======== void make_crc_table() ==========
+Inputs:   unsigned int *table
+Returns:
+Fills in the 256 entry table for the PNG CRC-32. It is
+cheap enough to build once per image.
+====================*/
+static void make_crc_table( unsigned int *table ) {
+
+  unsigned int c;
+  int n, k;
+
+  for ( n = 0; n < 256; n++ ) {
+    c = n;
+    for ( k = 0; k < 8; k++ )
+      c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    table[n] = c;
+  }
+}
+
+static unsigned int crc32( unsigned int *table, unsigned char *p, size_t n ) {
+
+  unsigned int c = 0xffffffff;
+
+  while ( n-- )
+    c = table[(c ^ *p++) & 0xff] ^ (c >> 8);
+  return c ^ 0xffffffff;
+}
+
+static unsigned int adler32( unsigned char *p, size_t n ) {
+
+  unsigned int a = 1, b = 0;
+  size_t chunk;
+
+  while ( n > 0 ) {
+    chunk = n < ADLER_CHUNK ? n : ADLER_CHUNK;
+    n-= chunk;
+    while ( chunk-- ) {
+      a+= *p++;
+      b+= a;
+    }
+    a%= ADLER_MOD;
+    b%= ADLER_MOD;
+  }
+  return (b << 16) | a;
+}
+
+/*
+  PNG chunks are a length, a type, the data and a CRC of
+  the type and data. begin_chunk() leaves the length blank
+  and returns where the type starts, end_chunk() fills in
+  the length and appends the CRC.
+*/
+static size_t begin_chunk( struct image_buffer *b, char *type ) {
+  put_u32_be(b, 0);
+  append_bytes(b, type, 4);
+  return b->size - 4;
+}
+
+static void end_chunk( struct image_buffer *b, size_t start,
+                       unsigned int *crc_table ) {
+  put_u32(b->data + start - 4, b->size - start - 4);
+  put_u32_be(b, crc32(crc_table, b->data + start, b->size - start));
+}
+
+/*
+  Deflate output, least significant bit first. Callers
+  reserve room for everything up front.
+*/
+struct bit_writer {
+  unsigned char *p;
+  unsigned long long bits;
+  int count;
+};
+
+static inline void put_bits( struct bit_writer *w, unsigned int v, int n ) {
+  w->bits|= (unsigned long long)v << w->count;
+  w->count+= n;
+  while ( w->count >= 8 ) {
+    *w->p++ = w->bits;
+    w->bits>>= 8;
+    w->count-= 8;
+  }
+}
+
+static unsigned int reverse_bits( unsigned int v, int n ) {
+
+  unsigned int r = 0;
+
+  while ( n-- ) {
+    r = (r << 1) | (v & 1);
+    v>>= 1;
+  }
+  return r;
+}
+
+static const int length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const int distance_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+
+/*
+  The fixed Huffman code (RFC 1951, 3.2.6) of every literal
+  and length symbol, bit reversed so it can go straight to
+  put_bits(), and the symbol of every match length.
+*/
+struct fixed_codes {
+  unsigned short code[288];
+  unsigned char bits[288];
+  unsigned short length_symbol[DEFLATE_MAX_MATCH + 1];
+};
+
+static void make_fixed_codes( struct fixed_codes *f ) {
+
+  int v, c, l;
+
+  for ( v = 0; v < 288; v++ ) {
+    if ( v < 144 ) {
+      c = 0x30 + v;
+      f->bits[v] = 8;
+    }
+    else if ( v < 256 ) {
+      c = 0x190 + v - 144;
+      f->bits[v] = 9;
+    }
+    else if ( v < 280 ) {
+      c = v - 256;
+      f->bits[v] = 7;
+    }
+    else {
+      c = 0xc0 + v - 280;
+      f->bits[v] = 8;
+    }
+    f->code[v] = reverse_bits(c, f->bits[v]);
+  }
+
+  //258 is also in 284's range, 285 is the shorter code for it
+  for ( c = 0; c < 29; c++ )
+    for ( l = length_base[c];
+          l < length_base[c] + (1 << length_extra[c]) && l <= DEFLATE_MAX_MATCH;
+          l++ )
+      f->length_symbol[l] = 257 + c;
+}
+
+static inline void put_symbol( struct bit_writer *w, struct fixed_codes *f,
+                               int v ) {
+  put_bits(w, f->code[v], f->bits[v]);
+}
+
+static void put_match( struct bit_writer *w, struct fixed_codes *f,
+                       int length, int distance ) {
+
+  int s, c, d, n;
+
+  s = f->length_symbol[length];
+  put_symbol(w, f, s);
+  c = s - 257;
+  if ( length_extra[c] )
+    put_bits(w, length - length_base[c], length_extra[c]);
+
+  //distance codes come in pairs per power of 2 above 4
+  d = distance - 1;
+  if ( d < 4 )
+    c = d;
+  else {
+    n = 31 - __builtin_clz(d);
+    c = 2 * n + ((d >> (n - 1)) & 1);
+  }
+  put_bits(w, reverse_bits(c, 5), 5);
+  if ( c >= 4 )
+    put_bits(w, distance - distance_base[c], (c >> 1) - 1);
+}
+
+static inline unsigned int hash3( unsigned char *p ) {
+  return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u)
+    >> (32 - DEFLATE_HASH_BITS);
+}
+
+/*======== void deflate_fast() ==========
+Inputs:   struct image_buffer *out
+         unsigned char *in
+         size_t n
+Returns:
+Compresses in as a single fixed Huffman block. Matches are
+found greedily: the table remembers the last position of
+every 3 byte hash and only that one is tried.
+====================*/
+static void deflate_fast( struct image_buffer *out, unsigned char *in,
+                          size_t n ) {
+
+  struct fixed_codes f;
+  struct bit_writer w;
+  int *head;
+  size_t i, j, limit;
+  long candidate;
+  unsigned int h;
+
+  make_fixed_codes(&f);
+  head = (int *)calloc(1 << DEFLATE_HASH_BITS, sizeof(int));
+
+  //a literal is at most 9 bits
+  reserve_bytes(out, n + n / 8 + 16);
+  w.p = out->data + out->size;
+  w.bits = 0;
+  w.count = 0;
+
+  put_bits(&w, 1, 1);
+  put_bits(&w, 1, 2);
+  i = 0;
+  while ( i < n ) {
+    if ( i + DEFLATE_MIN_MATCH <= n ) {
+      h = hash3(in + i);
+      candidate = (long)head[h] - 1;
+      head[h] = i + 1;
+      if ( candidate >= 0 && i - candidate <= DEFLATE_WINDOW &&
+           !memcmp(in + candidate, in + i, DEFLATE_MIN_MATCH) ) {
+        limit = n - i < DEFLATE_MAX_MATCH ? n - i : DEFLATE_MAX_MATCH;
+        for ( j = DEFLATE_MIN_MATCH; j < limit && in[candidate + j] == in[i + j]; j++ )
+          ;
+        put_match(&w, &f, j, i - candidate);
+        for ( limit = i + j, i++; i < limit; i++ )
+          if ( i + DEFLATE_MIN_MATCH <= n )
+            head[hash3(in + i)] = i + 1;
+        continue;
+      }
+    }
+    put_symbol(&w, &f, in[i]);
+    i++;
+  }
+  put_symbol(&w, &f, 256);
+  if ( w.count > 0 )
+    put_bits(&w, 0, 8 - w.count);
+
+  out->size = w.p - out->data;
+  free(head);
+}
+
+//in as uncompressed blocks
+static void deflate_stored( struct image_buffer *out, unsigned char *in,
+                            size_t n ) {
+
+  unsigned char header[5];
+  size_t len;
+
+  do {
+    len = n < DEFLATE_MAX_STORED ? n : DEFLATE_MAX_STORED;
+    header[0] = len == n;
+    header[1] = len;
+    header[2] = len >> 8;
+    header[3] = ~len;
+    header[4] = ~len >> 8;
+    append_bytes(out, header, 5);
+    append_bytes(out, in, len);
+    in+= len;
+    n-= len;
+  } while ( n > 0 );
+}
+
+/*======== void encode_png() ==========
+Inputs:   struct image_buffer *out
+         unsigned char *rgb
+         int width
+         int height
+Returns:
+Appends rgb to out as an 8 bit RGB PNG, compressed
+according to png_deflate. The fast mode filters every row
+with Sub, which turns flat areas into runs of zeros and
+smooth shading into small repeating steps.
+====================*/
+void encode_png( struct image_buffer *out, unsigned char *rgb,
+                 int width, int height ) {
+
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+  };
+  static const unsigned char zlib_header[2] = { 0x78, 0x01 };
+  unsigned int crc_table[256];
+  unsigned char ihdr[13], *raw, *row, *src;
+  size_t row_size, raw_size, start, i;
+  int y, mode = png_deflate;
+
+  make_crc_table(crc_table);
+  append_bytes(out, signature, 8);
+
+  put_u32(ihdr, width);
+  put_u32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = 2;
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  start = begin_chunk(out, "IHDR");
+  append_bytes(out, ihdr, 13);
+  end_chunk(out, start, crc_table);
+
+  row_size = (size_t)width * 3;
+  raw_size = (row_size + 1) * height;
+  raw = (unsigned char *)malloc(raw_size);
+  for ( y = 0; y < height; y++ ) {
+    row = raw + y * (row_size + 1);
+    src = rgb + y * row_size;
+    if ( mode == PNG_STORED ) {
+      row[0] = 0;
+      memcpy(row + 1, src, row_size);
+    }
+    else {
+      row[0] = 1;
+      for ( i = 0; i < 3 && i < row_size; i++ )
+        row[1 + i] = src[i];
+      for ( ; i < row_size; i++ )
+        row[1 + i] = src[i] - src[i - 3];
+    }
+  }
+
+  start = begin_chunk(out, "IDAT");
+  append_bytes(out, zlib_header, 2);
+  if ( mode == PNG_STORED )
+    deflate_stored(out, raw, raw_size);
+  else
+    deflate_fast(out, raw, raw_size);
+  put_u32_be(out, adler32(raw, raw_size));
+  end_chunk(out, start, crc_table);
+  free(raw);
+
+  start = begin_chunk(out, "IEND");
+  end_chunk(out, start, crc_table);
+}
+
+/*======== void encode_qoi() ==========
+Inputs:   struct image_buffer *out
+         unsigned char *rgb
+         int width
+         int height
+Returns:
+Appends rgb to out as a 3 channel QOI image (see
+qoiformat.org): runs of the previous pixel, references to
+recently seen pixels, small differences to the previous
+pixel, or the pixel itself.
+====================*/
+void encode_qoi( struct image_buffer *out, unsigned char *rgb,
+                 int width, int height ) {
+
+  static const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  unsigned int seen[64], pixel, prev;
+  unsigned char *px, *p;
+  size_t i, n;
+  int run, k;
+  signed char dr, dg, db, dr_dg, db_dg;
+
+  n = (size_t)width * height;
+  reserve_bytes(out, 14 + n * 4 + 8);
+  p = out->data + out->size;
+  memcpy(p, "qoif", 4);
+  put_u32(p + 4, width);
+  put_u32(p + 8, height);
+  p[12] = 3;
+  p[13] = 0;
+  p+= 14;
+
+  //pixels as RGBA in an int, alpha is always 255
+  memset(seen, 0, sizeof(seen));
+  prev = 0xff;
+  run = 0;
+  for ( i = 0; i < n; i++ ) {
+    px = rgb + i * 3;
+    pixel = (unsigned int)px[0] << 24 | px[1] << 16 | px[2] << 8 | 0xff;
+    if ( pixel == prev ) {
+      run++;
+      if ( run == QOI_MAX_RUN || i == n - 1 ) {
+        *p++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if ( run > 0 ) {
+      *p++ = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    k = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+    if ( seen[k] == pixel )
+      *p++ = QOI_OP_INDEX | k;
+    else {
+      seen[k] = pixel;
+      dr = px[0] - (prev >> 24);
+      dg = px[1] - (prev >> 16 & 0xff);
+      db = px[2] - (prev >> 8 & 0xff);
+      dr_dg = dr - dg;
+      db_dg = db - dg;
+      if ( dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2 )
+        *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+      else if ( dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 &&
+                db_dg > -9 && db_dg < 8 ) {
+        *p++ = QOI_OP_LUMA | (dg + 32);
+        *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+      }
+      else {
+        *p++ = QOI_OP_RGB;
+        *p++ = px[0];
+        *p++ = px[1];
+        *p++ = px[2];
+      }
+    }
+    prev = pixel;
+  }
+  memcpy(p, end_marker, 8);
+  out->size = p + 8 - out->data;
+}
@@ -0,0 +1,40 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+
+/*
+  In process image encoders, so frames can be saved without
+  starting convert. Both take packed 8 bit RGB (see
+  pack_rgb()) and append the encoded file to an
+  image_buffer, which grows as needed and can be reused
+  from frame to frame (set size back to 0 to empty it).
+
+  png_deflate picks how PNG pixel data is compressed:
+  PNG_STORED - no compression at all, the fastest to write
+  PNG_FAST   - rows filtered with Sub, then greedy LZ77 with
+               a single probe hash table and the fixed
+               Huffman codes
+*/
+#define PNG_STORED 0
+#define PNG_FAST 1
+
+struct image_buffer {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+};
+
+extern int png_deflate;
+
+void set_png_deflate( char *name );
+void free_image_buffer( struct image_buffer *b );
+void reserve_bytes( struct image_buffer *b, size_t n );
+void append_bytes( struct image_buffer *b, const void *p, size_t n );
+
+void encode_png( struct image_buffer *out, unsigned char *rgb,
+                 int width, int height );
+void encode_qoi( struct image_buffer *out, unsigned char *rgb,
+                 int width, int height );
+
+#endif
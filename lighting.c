@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "gmath.h"
+#include "material.h"
+#include "lighting.h"
+
+int light_cache_bits = 0;
+
+/*======== void init_lighting() ==========
+  Inputs:   struct lighting *l
+  Returns:
+  Starts l out with no lights, no material and no cache
+  ====================*/
+void init_lighting( struct lighting *l ) {
+  memset(l, 0, sizeof(struct lighting));
+}
+
+/*======== void free_lighting() ==========
+  Inputs:   struct lighting *l
+  Returns:
+  Frees the shading terms and the lighting cache
+  ====================*/
+void free_lighting( struct lighting *l ) {
+
+  int i;
+
+  for (i=0; i < l->num_caches; i++)
+    free(l->caches[i]);
+  free(l->caches);
+  free(l->terms);
+  l->terms = NULL;
+  l->num_terms = 0;
+  l->caches = NULL;
+  l->num_caches = 0;
+  l->cache = NULL;
+}
+
+/*======== void set_light_cache_bits() ==========
+  Inputs:   int bits
+  Returns:
+  Sets how finely normals are quantized for the lighting
+  cache, 0 to turn it off. Exits if bits is out of range.
+  ====================*/
+void set_light_cache_bits( int bits ) {
+
+  if ( bits != 0 &&
+       (bits < LIGHT_CACHE_MIN_BITS || bits > LIGHT_CACHE_MAX_BITS) ) {
+    printf("Error: Light cache bits must be 0 or %d to %d, not %d\n",
+           LIGHT_CACHE_MIN_BITS, LIGHT_CACHE_MAX_BITS, bits);
+    exit(1);
+  }
+  light_cache_bits = bits;
+}
+
+/*======== void print_light_cache_stats() ==========
+  Inputs:   struct lighting *l
+  Returns:
+  Prints the lighting cache hit rate, if the cache is on
+  ====================*/
+void print_light_cache_stats( struct lighting *l ) {
+
+  if ( light_cache_bits == 0 )
+    return;
+  printf("Light cache: %d bits, %ld of %ld lookups hit (%.1f%%)\n",
+         light_cache_bits, l->cache_hits, l->cache_lookups,
+         l->cache_lookups ? 100.0 * l->cache_hits / l->cache_lookups : 0);
+}
+
+//empties every material's cache by moving on to a new stamp
+static void empty_cache( struct lighting *l ) {
+
+  int i;
+
+  if ( light_cache_bits == 0 )
+    return;
+  l->cache_stamp++;
+  if ( l->cache_stamp == 0 ) {
+    for (i=0; i < l->num_caches; i++)
+      if ( l->caches[i] != NULL )
+        memset(l->caches[i], 0, ((size_t)1 << (2 * light_cache_bits)) *
+               sizeof(struct light_cache_entry));
+    l->cache_stamp = 1;
+  }
+}
+
+//material's cache table, made empty the first time, or NULL
+//with the cache off
+static struct light_cache_entry *material_cache( struct lighting *l,
+                                                 int material ) {
+
+  if ( light_cache_bits == 0 )
+    return NULL;
+  if ( l->caches[material] == NULL )
+    l->caches[material] = (struct light_cache_entry *)
+      calloc((size_t)1 << (2 * light_cache_bits),
+             sizeof(struct light_cache_entry));
+  return l->caches[material];
+}
+
+typedef int lightmask __attribute__((vector_size(sizeof(lightvec))));
+
+//v where mask is set, 0 elsewhere
+#define MASKED(v, mask) ((lightvec)((lightmask)(v) & (mask)))
+
+//b^e for an integer e >= 1, by repeated squaring
+static inline lightvec int_power( lightvec b, int e ) {
+
+  lightvec p = b;
+
+  for (e--; e; e>>= 1) {
+    if ( e & 1 )
+      p*= b;
+    b*= b;
+  }
+  return p;
+}
+
+//b^e for any e, one lane at a time
+static inline lightvec lane_power( lightvec b, float e ) {
+
+  float f[LIGHT_LANES];
+  int lane;
+
+  memcpy(f, &b, sizeof(b));
+  for (lane=0; lane < LIGHT_LANES; lane++)
+    f[lane] = powf(f[lane], e);
+  memcpy(&b, f, sizeof(b));
+  return b;
+}
+
+//1 / sqrt(x), from the usual bit level guess and two Newton steps
+static inline lightvec inverse_sqrt( lightvec x ) {
+
+  lightvec y;
+
+  y = (lightvec)(0x5f3759df - ((lightmask)x >> 1));
+  y = y * (1.5f - 0.5f * x * y * y);
+  y = y * (1.5f - 0.5f * x * y * y);
+  return y;
+}
+
+static int color_component( float f ) {
+  if ( f <= 0 )
+    return 0;
+  if ( f >= MAX_COLOR )
+    return MAX_COLOR;
+  return (int)f;
+}
+
+/*======== shading kernels ==========
+  Each kernel lights n unit normals with one material and
+  writes their colors to out, LIGHT_LANES normals at a time.
+
+  For each light, with d = n . l:
+  diffuse  = color x dreflect x max(d, 0)
+  specular = color x sreflect x max(r . v, 0)^exponent
+  where r . v = 2d(n . v) - l . v is the reflected light
+  against the view vector. Lights behind the surface add
+  nothing. Ambient is added once.
+
+  The kernels only differ in how the specular power is
+  taken, POWER(r, t) raises r to the material's exponent:
+  shade_exp4     - the default exponent, unrolled
+  shade_int_exp  - other integer exponents, by repeated
+                   squaring
+  shade_any_exp  - anything else, with powf
+  shade_diffuse  - materials with no specular reflection
+  ====================*/
+#define DEFINE_SHADE_KERNEL(NAME, SPECULAR, POWER)                      \
+  static void NAME( struct lighting *l, struct shading_terms *t,        \
+                    float *nx, float *ny, float *nz,                    \
+                    int n, color *out ) {                               \
+                                                                        \
+    int i, k, lane;                                                     \
+    lightvec x, y, z, ndotv, d, r, spec, red, green, blue;              \
+    lightvec zero = {0};                                                \
+    float rgb[3][LIGHT_LANES];                                          \
+                                                                        \
+    for (k=0; k < n; k+= LIGHT_LANES) {                                 \
+      x = *(lightvec *)(nx + k);                                        \
+      y = *(lightvec *)(ny + k);                                        \
+      z = *(lightvec *)(nz + k);                                        \
+      ndotv = x * l->view[0] + y * l->view[1] + z * l->view[2];         \
+                                                                        \
+      red = zero + t->ar;                                               \
+      green = zero + t->ag;                                             \
+      blue = zero + t->ab;                                              \
+                                                                        \
+      for (i=0; i < l->num_lights; i++) {                               \
+        d = x * l->lx[i] + y * l->ly[i] + z * l->lz[i];                 \
+        d = MASKED(d, d > 0);                                           \
+        red+= d * t->dr[i];                                             \
+        green+= d * t->dg[i];                                           \
+        blue+= d * t->db[i];                                            \
+                                                                        \
+        if ( SPECULAR ) {                                               \
+          r = 2 * d * ndotv - l->ldotv[i];                              \
+          r = MASKED(r, (r > 0) & (d > 0));                             \
+          spec = POWER(r, t);                                           \
+          red+= spec * t->sr[i];                                        \
+          green+= spec * t->sg[i];                                      \
+          blue+= spec * t->sb[i];                                       \
+        }                                                               \
+      }                                                                 \
+                                                                        \
+      memcpy(rgb[RED], &red, sizeof(red));                              \
+      memcpy(rgb[GREEN], &green, sizeof(green));                        \
+      memcpy(rgb[BLUE], &blue, sizeof(blue));                           \
+      for (lane=0; lane < LIGHT_LANES && k + lane < n; lane++) {        \
+        out[k + lane].red = color_component(rgb[RED][lane]);            \
+        out[k + lane].green = color_component(rgb[GREEN][lane]);        \
+        out[k + lane].blue = color_component(rgb[BLUE][lane]);          \
+      }                                                                 \
+    }                                                                   \
+  }
+
+#define POWER_EXP4(r, t) int_power(r, 4)
+#define POWER_INT_EXP(r, t) int_power(r, (t)->int_exp)
+#define POWER_ANY_EXP(r, t) lane_power(r, (t)->specular_exp)
+
+DEFINE_SHADE_KERNEL(shade_exp4, 1, POWER_EXP4)
+DEFINE_SHADE_KERNEL(shade_int_exp, 1, POWER_INT_EXP)
+DEFINE_SHADE_KERNEL(shade_any_exp, 1, POWER_ANY_EXP)
+DEFINE_SHADE_KERNEL(shade_diffuse, 0, POWER_EXP4)
+
+//premultiplies material m for the lights in l
+static void setup_terms( struct lighting *l, struct shading_terms *t,
+                         struct material *m ) {
+
+  int i;
+
+  t->ar = l->ambient[RED] * m->areflect[RED];
+  t->ag = l->ambient[GREEN] * m->areflect[GREEN];
+  t->ab = l->ambient[BLUE] * m->areflect[BLUE];
+
+  for (i=0; i < l->num_lights; i++) {
+    t->dr[i] = l->lr[i] * m->dreflect[RED];
+    t->dg[i] = l->lg[i] * m->dreflect[GREEN];
+    t->db[i] = l->lb[i] * m->dreflect[BLUE];
+    t->sr[i] = l->lr[i] * m->sreflect[RED];
+    t->sg[i] = l->lg[i] * m->sreflect[GREEN];
+    t->sb[i] = l->lb[i] * m->sreflect[BLUE];
+  }
+
+  t->specular_exp = m->specular_exp;
+  t->int_exp = m->specular_exp <= LIGHT_MAX_INT_EXP ?
+    (int)m->specular_exp : 0;
+  if ( m->sreflect[RED] == 0 && m->sreflect[GREEN] == 0 &&
+       m->sreflect[BLUE] == 0 )
+    t->kernel = shade_diffuse;
+  else if ( m->specular_exp == 4 )
+    t->kernel = shade_exp4;
+  else if ( m->specular_exp == t->int_exp )
+    t->kernel = shade_int_exp;
+  else
+    t->kernel = shade_any_exp;
+}
+
+/*======== void setup_lights() ==========
+  Inputs:   struct lighting *l
+  double *view
+  color ambient
+  double light[][2][3]
+  int num_lights
+  Returns:
+  Fills in the per frame part of l: the view vector, the
+  ambient light and every light's unit direction and color,
+  then the shading terms of every material for those
+  lights. Lights with no direction are skipped. Leaves the
+  default material bound.
+  ====================*/
+void setup_lights( struct lighting *l, double *view, color ambient,
+                   double light[][2][3], int num_lights ) {
+
+  int i, n;
+  double v[3], dir[3];
+
+  v[0] = view[0];
+  v[1] = view[1];
+  v[2] = view[2];
+  normalize(v);
+  l->view[0] = v[0];
+  l->view[1] = v[1];
+  l->view[2] = v[2];
+
+  l->ambient[RED] = ambient.red;
+  l->ambient[GREEN] = ambient.green;
+  l->ambient[BLUE] = ambient.blue;
+
+  n = 0;
+  for (i=0; i < num_lights && n < MAX_LIGHTS; i++) {
+    dir[0] = light[i][LOCATION][0];
+    dir[1] = light[i][LOCATION][1];
+    dir[2] = light[i][LOCATION][2];
+    if ( dot_product(dir, dir) == 0 )
+      continue;
+    normalize(dir);
+
+    l->lx[n] = dir[0];
+    l->ly[n] = dir[1];
+    l->lz[n] = dir[2];
+    l->ldotv[n] = dot_product(dir, v);
+    l->lr[n] = light[i][COLOR][RED];
+    l->lg[n] = light[i][COLOR][GREEN];
+    l->lb[n] = light[i][COLOR][BLUE];
+    n++;
+  }
+  l->num_lights = n;
+
+  if ( l->num_terms < num_materials ) {
+    l->terms = (struct shading_terms *)
+      realloc(l->terms, num_materials * sizeof(struct shading_terms));
+    l->num_terms = num_materials;
+  }
+  for (i=0; i < num_materials; i++)
+    setup_terms(l, l->terms + i, materials + i);
+
+  if ( l->num_caches < num_materials ) {
+    l->caches = (struct light_cache_entry **)
+      realloc(l->caches, num_materials * sizeof(struct light_cache_entry *));
+    for (i=l->num_caches; i < num_materials; i++)
+      l->caches[i] = NULL;
+    l->num_caches = num_materials;
+  }
+  empty_cache(l);
+  l->bound = l->terms + DEFAULT_MATERIAL;
+  l->cache = material_cache(l, DEFAULT_MATERIAL);
+}
+
+/*======== void bind_material() ==========
+  Inputs:   struct lighting *l
+  int material
+  Returns:
+  Makes material the one shade_normals() and light_normals()
+  use, along with its own lighting cache. Cheap when it is
+  already bound.
+  ====================*/
+void bind_material( struct lighting *l, int material ) {
+
+  if ( l->bound == l->terms + material )
+    return;
+  l->bound = l->terms + material;
+  l->cache = material_cache(l, material);
+}
+
+/*======== void normalize_normals() ==========
+  Inputs:   float *nx, *ny, *nz
+  int n
+  Returns:
+  Scales n normals to unit length in place, LIGHT_LANES at
+  a time. Same alignment and padding rules as
+  shade_normals(). Zero normals come out pointing nowhere
+  in particular but finite.
+  ====================*/
+void normalize_normals( float *nx, float *ny, float *nz, int n ) {
+
+  lightvec x, y, z, m;
+  lightvec tiny = {0};
+  int k;
+
+  tiny+= 1e-20f;
+  for (k=0; k < n; k+= LIGHT_LANES) {
+    x = *(lightvec *)(nx + k);
+    y = *(lightvec *)(ny + k);
+    z = *(lightvec *)(nz + k);
+    m = x * x + y * y + z * z;
+    m = MASKED(m, m > tiny) + MASKED(tiny, m <= tiny);
+    m = inverse_sqrt(m);
+    *(lightvec *)(nx + k) = x * m;
+    *(lightvec *)(ny + k) = y * m;
+    *(lightvec *)(nz + k) = z * m;
+  }
+}
+
+/*======== void shade_normals() ==========
+  Inputs:   struct lighting *l
+  float *nx, *ny, *nz
+  int n
+  color *out
+  Returns:
+  Lights n unit normals with the bound material and writes
+  their colors to out.
+
+  The normal arrays must be aligned to a lightvec and padded
+  with anything to a multiple of LIGHT_LANES, every vector
+  step shades LIGHT_LANES normals against one light.
+  ====================*/
+void shade_normals( struct lighting *l, float *nx, float *ny, float *nz,
+                    int n, color *out ) {
+  l->bound->kernel(l, l->bound, nx, ny, nz, n, out);
+}
+
+static float sign( float f ) {
+  return f >= 0 ? 1 : -1;
+}
+
+/*
+  Octahedral encoding: the normal is projected onto the
+  octahedron |x| + |y| + |z| = 1, the lower half is folded
+  over the upper one, and the resulting square is split
+  into (2^bits)^2 cells.
+*/
+static unsigned int octahedral_key( float x, float y, float z ) {
+
+  float levels = (1 << light_cache_bits) - 1;
+  float s = fabsf(x) + fabsf(y) + fabsf(z);
+  float u = x / s;
+  float v = y / s;
+  float t;
+
+  if ( z < 0 ) {
+    t = u;
+    u = (1 - fabsf(v)) * sign(t);
+    v = (1 - fabsf(t)) * sign(v);
+  }
+  return ((unsigned int)((v + 1) * 0.5f * levels + 0.5f) << light_cache_bits) |
+    (unsigned int)((u + 1) * 0.5f * levels + 0.5f);
+}
+
+//the unit normal at the center of a key's cell
+static void octahedral_normal( unsigned int key, float *x, float *y, float *z ) {
+
+  float levels = (1 << light_cache_bits) - 1;
+  float u = (key & ((1 << light_cache_bits) - 1)) * 2 / levels - 1;
+  float v = (key >> light_cache_bits) * 2 / levels - 1;
+  float w = 1 - fabsf(u) - fabsf(v);
+  float t, m;
+
+  if ( w < 0 ) {
+    t = u;
+    u = (1 - fabsf(v)) * sign(t);
+    v = (1 - fabsf(t)) * sign(v);
+  }
+  m = sqrtf(u * u + v * v + w * w);
+  *x = u / m;
+  *y = v / m;
+  *z = w / m;
+}
+
+/*======== void light_normals() ==========
+  Inputs:   struct lighting *l
+  float *nx, *ny, *nz
+  int n
+  color *out
+  Returns:
+  Same as shade_normals(), but goes through the lighting
+  cache when it is on. n can be at most LIGHT_BATCH.
+  Normals that miss are snapped to their cell's center and
+  shaded together.
+  ====================*/
+void light_normals( struct lighting *l, float *nx, float *ny, float *nz,
+                    int n, color *out ) {
+
+  float mx[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float my[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  float mz[LIGHT_BATCH] __attribute__((aligned(sizeof(lightvec))));
+  unsigned int keys[LIGHT_BATCH];
+  int misses[LIGHT_BATCH];
+  color shaded[LIGHT_BATCH];
+  struct light_cache_entry *e;
+  int i, m;
+
+  if ( l->cache == NULL ) {
+    shade_normals(l, nx, ny, nz, n, out);
+    return;
+  }
+
+  m = 0;
+  for (i=0; i < n; i++) {
+    keys[m] = octahedral_key(nx[i], ny[i], nz[i]);
+    e = l->cache + keys[m];
+    if ( e->stamp == l->cache_stamp )
+      out[i] = e->c;
+    else {
+      octahedral_normal(keys[m], mx + m, my + m, mz + m);
+      misses[m++] = i;
+    }
+  }
+  l->cache_lookups+= n;
+  l->cache_hits+= n - m;
+
+  shade_normals(l, mx, my, mz, m, shaded);
+  for (i=0; i < m; i++) {
+    e = l->cache + keys[i];
+    e->stamp = l->cache_stamp;
+    e->c = shaded[i];
+    out[misses[i]] = shaded[i];
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include "ml6.h"
+#include "lights.h"
+
+/*
+  Lighting is prepared ahead of time so the per triangle
+  work is only the shading itself:
+
+  setup_lights()  - once per frame. Normalizes every light
+                    direction and stores the lights as a
+                    structure of arrays. Then, for every
+                    material, multiplies each light's color
+                    by the material's reflectance and picks
+                    a shading kernel by its specular
+                    exponent.
+  bind_material() - selects the material to shade with.
+
+  shade_normals() then lights a batch of unit normals
+  against all the lights, LIGHT_LANES normals at a time.
+
+  normalize_normals() makes interpolated normals unit length
+  first, for per pixel (phong) shading.
+
+  light_normals() puts an optional cache in front of
+  shade_normals(). With directional lights and a fixed
+  view, a flat shaded color only depends on the normal and
+  the material, so colors are kept in a table indexed by
+  the normal's octahedral encoding, light_cache_bits bits
+  per axis. Each material gets its own table the first time
+  it is bound, so switching between materials keeps what
+  they have cached. The tables are emptied once per frame,
+  when the lights are set up. Cached or not, the color is
+  always that of the quantized normal, so images don't
+  depend on drawing order.
+*/
+
+//number of normals shade_normals() works on in one SIMD step,
+//a single SSE2 register of floats
+#define LIGHT_LANES 4
+//most normals draw_polygons() collects before shading them
+#define LIGHT_BATCH 64
+
+//light_cache_bits limits, 0 turns the cache off
+#define LIGHT_CACHE_MIN_BITS 4
+#define LIGHT_CACHE_MAX_BITS 10
+
+//integer specular exponents up to this use repeated squaring
+#define LIGHT_MAX_INT_EXP 256
+
+typedef float lightvec __attribute__((vector_size(LIGHT_LANES * sizeof(float))));
+
+struct lighting;
+struct shading_terms;
+
+typedef void (*shade_kernel)( struct lighting *l, struct shading_terms *t,
+                              float *nx, float *ny, float *nz,
+                              int n, color *out );
+
+//one material lit by the current lights
+struct shading_terms {
+  shade_kernel kernel;
+  float specular_exp;
+  int int_exp;
+
+  //ambient x areflect, light color x dreflect, x sreflect
+  float ar, ag, ab;
+  float dr[MAX_LIGHTS], dg[MAX_LIGHTS], db[MAX_LIGHTS];
+  float sr[MAX_LIGHTS], sg[MAX_LIGHTS], sb[MAX_LIGHTS];
+};
+
+struct lighting {
+  int num_lights;
+  float view[3];
+  float ambient[3];
+
+  //unit vector towards each light, its color and l . view
+  float lx[MAX_LIGHTS], ly[MAX_LIGHTS], lz[MAX_LIGHTS];
+  float lr[MAX_LIGHTS], lg[MAX_LIGHTS], lb[MAX_LIGHTS];
+  float ldotv[MAX_LIGHTS];
+
+  //one entry per material, and the one being shaded with
+  struct shading_terms *terms;
+  int num_terms;
+  struct shading_terms *bound;
+
+  //a cache table per material (NULL until it is bound) and
+  //the bound material's. Entries with a stamp other than
+  //cache_stamp are empty
+  struct light_cache_entry **caches;
+  int num_caches;
+  struct light_cache_entry *cache;
+  unsigned int cache_stamp;
+  long cache_lookups, cache_hits;
+};
+
+struct light_cache_entry {
+  unsigned int stamp;
+  color c;
+};
+
+extern int light_cache_bits;
+
+void init_lighting( struct lighting *l );
+void free_lighting( struct lighting *l );
+void set_light_cache_bits( int bits );
+void print_light_cache_stats( struct lighting *l );
+
+void setup_lights( struct lighting *l, double *view, color ambient,
+                   double light[][2][3], int num_lights );
+void bind_material( struct lighting *l, int material );
+void shade_normals( struct lighting *l, float *nx, float *ny, float *nz,
+                    int n, color *out );
+void light_normals( struct lighting *l, float *nx, float *ny, float *nz,
+                    int n, color *out );
+void normalize_normals( float *nx, float *ny, float *nz, int n );
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "parser.h"
+#include "gmath.h"
+#include "material.h"
+
+struct material *materials = NULL;
+int num_materials = 0;
+static int max_materials = 0;
+
+static int new_material() {
+
+  if ( num_materials == max_materials ) {
+    max_materials = max_materials ? 2 * max_materials : 16;
+    materials = (struct material *)
+      realloc(materials, max_materials * sizeof(struct material));
+  }
+  return num_materials++;
+}
+
+/*======== void init_materials() ==========
+  Inputs:
+  Returns:
+  Starts the material table off with just the default
+  material, used by shapes without constants
+  ====================*/
+void init_materials() {
+
+  struct material *m;
+  int i;
+
+  num_materials = 0;
+  i = new_material();
+  m = materials + i;
+  for (i=0; i < 3; i++) {
+    m->areflect[i] = 0.1;
+    m->dreflect[i] = 0.5;
+    m->sreflect[i] = 0.5;
+  }
+  m->specular_exp = DEFAULT_SPECULAR_EXP;
+}
+
+/*======== int add_material() ==========
+  Inputs:   struct constants *c
+  Returns:  the index of the new material
+
+  Copies the reflection constants and specular exponent of
+  c into the material table. Exits if the exponent isn't
+  positive.
+  ====================*/
+int add_material( struct constants *c ) {
+
+  struct material *m;
+  int i;
+
+  if ( !(c->specular_exp > 0) ) {
+    printf("Error: Specular exponent must be positive, not %g\n",
+           c->specular_exp);
+    exit(1);
+  }
+
+  i = new_material();
+  m = materials + i;
+  m->areflect[RED] = c->r[Ka];
+  m->areflect[GREEN] = c->g[Ka];
+  m->areflect[BLUE] = c->b[Ka];
+  m->dreflect[RED] = c->r[Kd];
+  m->dreflect[GREEN] = c->g[Kd];
+  m->dreflect[BLUE] = c->b[Kd];
+  m->sreflect[RED] = c->r[Ks];
+  m->sreflect[GREEN] = c->g[Ks];
+  m->sreflect[BLUE] = c->b[Ks];
+  m->specular_exp = c->specular_exp;
+  return i;
+}
@@ -0,0 +1,27 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "symtab.h"
+
+/*
+  Every constants command is turned into a material when it
+  is parsed, and shapes refer to materials by index. Index
+  DEFAULT_MATERIAL is what shapes without constants use.
+*/
+#define DEFAULT_MATERIAL 0
+#define DEFAULT_SPECULAR_EXP 4
+
+struct material {
+  double areflect[3];
+  double dreflect[3];
+  double sreflect[3];
+  double specular_exp;
+};
+
+extern struct material *materials;
+extern int num_materials;
+
+void init_materials();
+int add_material( struct constants *c );
+
+#endif
@@ -200,6 +200,44 @@ struct matrix * make_rotZ(double theta) {
 }
 
 
+/*======== struct matrix * make_normal_matrix() ==========
+Inputs:  struct matrix *m
+Returns: The matrix that transforms normals the way m
+transforms points: the inverse transpose of m's upper
+left 3x3, with no translation.
+
+It is computed as the cofactor matrix over the determinant.
+If m flattens everything (determinant 0) the cofactors are
+used as they are, which still point the right way for the
+directions m keeps.
+====================*/
+struct matrix * make_normal_matrix(struct matrix *m) {
+  struct matrix *t = new_matrix(4, 4);
+  double **a = m->m;
+  double det;
+  int r, c;
+  ident(t);
+
+  t->m[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+  t->m[0][1] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+  t->m[0][2] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+  t->m[1][0] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+  t->m[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+  t->m[1][2] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+  t->m[2][0] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+  t->m[2][1] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+  t->m[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+  det = a[0][0] * t->m[0][0] + a[0][1] * t->m[0][1] + a[0][2] * t->m[0][2];
+  if ( det != 0 )
+    for (r=0; r < 3; r++)
+      for (c=0; c < 3; c++)
+        t->m[r][c]/= det;
+
+  return t;
+}
+
+
 /*-------------- void print_matrix() --------------
 Inputs:  struct matrix *m 
 Returns: 
@@ -8,7 +8,7 @@ struct matrix {
   double **m;
   int rows, cols;
   int lastcol;
-} matrix;
+};
 
 //curve routines
 struct matrix * make_bezier();
@@ -22,6 +22,7 @@ struct matrix * make_scale(double x, double y, double z);
 struct matrix * make_rotX(double theta);
 struct matrix * make_rotY(double theta);
 struct matrix * make_rotZ(double theta);
+struct matrix * make_normal_matrix(struct matrix *m);
 
 //Basic matrix manipulation routines
 struct matrix *new_matrix(int rows, int cols);
@@ -7,6 +7,17 @@
 #include "parser.h"
 #include "matrix.h"
 #include "obj_reader.h"
+#include "display.h"
+#include "lighting.h"
+#include "material.h"
+#include "image.h"
+#include "gif.h"
+#include "queue.h"
+#include "stream.h"
+#include "ring.h"
+#include "farm.h"
+#include "cache.h"
+#include "program.h"
 
 #if YYBISON
   int yylex();
@@ -22,6 +33,15 @@
   struct matrix *m;
   int lastop=0;
   int lineno=0;
+  int num_frames;
+  char name[128];
+  int cli_resolution=0;
+  int render_threads=1;
+  int first_frame=0, last_frame=-1;
+  int shard=0, shards=1;
+  int no_animation=0;
+  int no_layers=0;
+  int dump_program=0;
   %}
 
 
@@ -39,6 +59,7 @@
 %token <string> SPHERE TORUS BOX LINE CS MESH TEXTURE
 %token <string> STRING
 %token <string> SET MOVE SCALE ROTATE BASENAME SAVE_KNOBS TWEEN FRAMES VARY
+%token <string> RESOLUTION
 %token <string> PUSH POP SAVE GENERATE_RAYFILES
 %token <string> SHADING SHADING_TYPE SETKNOBS FOCAL DISPLAY WEB
 %token <string> CO
@@ -447,7 +468,7 @@ MOVE DOUBLE DOUBLE DOUBLE STRING
   op[lastop].op.move.d[1] = $3;
   op[lastop].op.move.d[2] = $4;
   op[lastop].op.move.d[3] = 0;
-  op[lastop].op.move.p = add_symbol($5,SYM_VALUE,0);
+  op[lastop].op.move.p = add_knob($5);
   lastop++;
 }|
 MOVE DOUBLE DOUBLE DOUBLE
@@ -470,7 +491,7 @@ SCALE DOUBLE DOUBLE DOUBLE STRING
   op[lastop].op.scale.d[1] = $3;
   op[lastop].op.scale.d[2] = $4;
   op[lastop].op.scale.d[3] = 0;
-  op[lastop].op.scale.p = add_symbol($5,SYM_VALUE,0);
+  op[lastop].op.scale.p = add_knob($5);
   lastop++;
 }|
 SCALE DOUBLE DOUBLE DOUBLE
@@ -505,7 +526,7 @@ ROTATE STRING DOUBLE STRING
     }
 
   op[lastop].op.rotate.degrees = $3;
-  op[lastop].op.rotate.p = add_symbol($4,SYM_VALUE,0);
+  op[lastop].op.rotate.p = add_knob($4);
   lastop++;
 }|
 ROTATE STRING DOUBLE
@@ -603,6 +624,38 @@ CONSTANTS STRING DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
   c->red = 0;
   c->green = 0;
   c->blue = 0;
+  c->specular_exp = DEFAULT_SPECULAR_EXP;
+  c->material = add_material(c);
+
+  op[lastop].op.constants.p =  add_symbol($2,SYM_CONSTANTS,c);
+  op[lastop].opcode=CONSTANTS;
+  lastop++;
+}|
+
+CONSTANTS STRING DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
+{
+  lineno++;
+  c = (struct constants *)malloc(sizeof(struct constants));
+  c->r[0]=$3;
+  c->r[1]=$4;
+  c->r[2]=$5;
+  c->r[3]=0;
+
+  c->g[0]=$6;
+  c->g[1]=$7;
+  c->g[2]=$8;
+  c->g[3]=0;
+
+  c->b[0]=$9;
+  c->b[1]=$10;
+  c->b[2]=$11;
+  c->b[3]=0;
+
+  c->red = 0;
+  c->green = 0;
+  c->blue = 0;
+  c->specular_exp = $12;
+  c->material = add_material(c);
 
   op[lastop].op.constants.p =  add_symbol($2,SYM_CONSTANTS,c);
   op[lastop].opcode=CONSTANTS;
@@ -631,6 +684,39 @@ CONSTANTS STRING DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
   c->red = $12;
   c->green = $13;
   c->blue = $14;
+  c->specular_exp = DEFAULT_SPECULAR_EXP;
+  c->material = add_material(c);
+
+  op[lastop].op.constants.p =  add_symbol($2,SYM_CONSTANTS,c);
+  op[lastop].opcode=CONSTANTS;
+  lastop++;
+}|
+
+CONSTANTS STRING DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
+{
+  lineno++;
+  c = (struct constants *)malloc(sizeof(struct constants));
+  c->r[0]=$3;
+  c->r[1]=$4;
+  c->r[2]=$5;
+  c->r[3]=0;
+
+  c->g[0]=$6;
+  c->g[1]=$7;
+  c->g[2]=$8;
+  c->g[3]=0;
+
+  c->b[0]=$9;
+  c->b[1]=$10;
+  c->b[2]=$11;
+  c->b[3]=0;
+
+  c->red = $12;
+  c->green = $13;
+  c->blue = $14;
+  c->specular_exp = $15;
+  c->material = add_material(c);
+
   op[lastop].op.constants.p =  add_symbol($2,SYM_CONSTANTS,c);
   op[lastop].opcode=CONSTANTS;
   lastop++;
@@ -687,7 +773,7 @@ SET STRING DOUBLE
 {
   lineno++;
   op[lastop].opcode = SET;
-  op[lastop].op.set.p = add_symbol($2,SYM_VALUE,0);
+  op[lastop].op.set.p = add_knob($2);
   set_value(op[lastop].op.set.p,$3);
   op[lastop].op.set.val = $3;
   lastop++;
@@ -727,11 +813,20 @@ FRAMES DOUBLE
   lastop++;
 }|
 
+RESOLUTION DOUBLE DOUBLE
+{
+  lineno++;
+  op[lastop].opcode = RESOLUTION;
+  op[lastop].op.resolution.width = $2;
+  op[lastop].op.resolution.height = $3;
+  lastop++;
+}|
+
 VARY STRING DOUBLE DOUBLE DOUBLE DOUBLE
 {
   lineno++;
   op[lastop].opcode = VARY;
-  op[lastop].op.vary.p = add_symbol($2,SYM_STRING,0);
+  op[lastop].op.vary.p = add_knob($2);
   op[lastop].op.vary.start_frame = $3;
   op[lastop].op.vary.end_frame = $4;
   op[lastop].op.vary.start_val = $5;
@@ -744,7 +839,7 @@ VARY STRING DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
 {
   lineno++;
   op[lastop].opcode = VARY;
-  op[lastop].op.vary.p = add_symbol($2,SYM_STRING,0);
+  op[lastop].op.vary.p = add_knob($2);
   op[lastop].op.vary.start_frame = $3;
   op[lastop].op.vary.end_frame = $4;
   op[lastop].op.vary.start_val = $5;
@@ -820,41 +915,178 @@ int yylex();
 extern FILE *yyin;
 
 
+void usage(char *prog) {
+  printf("Usage: %s [options] <MDL file>\n", prog);
+  printf("  -r, --resolution WxH\timage size, overrides the resolution command\n");
+  printf("  -d, --depth FORMAT\tzbuffer format, float32 (default) or int24\n");
+  printf("  -l, --light-cache BITS\tcache flat shading by normal, quantized to\n"
+         "\t\t\tBITS bits per axis (%d-%d, 0 is off)\n",
+         LIGHT_CACHE_MIN_BITS, LIGHT_CACHE_MAX_BITS);
+  printf("  -p, --png MODE\tPNG compression, fast (default) or stored\n");
+  printf("  -g, --gif MODE\tanimation colors, dither (default), fixed, or\n"
+         "\t\t\tconvert to have convert make it from the frames\n");
+  printf("  --frames A-B\t\tonly draw frames A to B (or just frame A)\n");
+  printf("  --shard K/N\t\tsplit the frames into N even runs and only draw\n"
+         "\t\t\trun K, counting from 0\n");
+  printf("  --no-animation\tdon't make the GIF\n");
+  printf("  --cache DIR\t\tkeep frames in DIR to reuse when the same frame\n"
+         "\t\t\tcomes up again, in this run or a later one (off\n"
+         "\t\t\tby default, DIR is never cleaned up)\n");
+  printf("  --no-layers\t\tdraw everything every frame, even what doesn't\n"
+         "\t\t\tmove\n");
+  printf("  --dump-program	print the program frames run, compiled from the\n"
+         "\t\t\tscript, and stop\n");
+  printf("  -j, --jobs N\t\tdraw N frames at once, on N threads (1-%d,\n"
+         "\t\t\tdefault 1)\n", QUEUE_MAX_DEPTH);
+  printf("  --farm N\t\tdraw frames in N worker processes (1-%d), which\n"
+         "\t\t\tare restarted if they crash\n", FARM_MAX_WORKERS);
+  printf("  -q, --queue N\t\tframes that can wait to be saved while the next\n"
+         "\t\t\trenders (0-%d, default %d, 0 saves each frame first)\n",
+         QUEUE_MAX_DEPTH, QUEUE_DEFAULT_DEPTH);
+  printf("  -s, --stream TARGET\tstream frames to a file, a named pipe or - for\n"
+         "\t\t\tstdout instead of saving them\n");
+  printf("  -f, --stream-format F\ty4m (default) or rgb\n");
+  printf("  -m, --shm NAME\t\talso share frames in the shared memory ring NAME\n");
+  printf("  --shm-slots N\t\tframes in the ring (1-%d, default %d)\n",
+         RING_MAX_SLOTS, RING_DEFAULT_SLOTS);
+  printf("  --shm-full POLICY\twhen the ring is full, overwrite (default), drop\n"
+         "\t\t\tor block\n");
+  exit(1);
+}
+
 int main(int argc, char **argv) {
 
-  /*
-  char help_manual[] = "Not enough arguments";
-  struct matrix *mat;
-  
-  if(argc < 2){
-    printf("%s\n", help_manual);
-    exit(0);
-  }
-  
-  if(argv[1][0] != '-'){
-    yyin = fopen(argv[1],"r");
-    yyparse();
-  } else{
-    if(strcmp(argv[1],"--obj") == 0){
-      if(argc >= 3){
-        mat = new_matrix(4, 4); // fix this if needed
-        read_obj_file(argv[2], mat);
-      }
-      else{
-        printf("please specify an .obj file\n");
-	exit(0);
+  char *script = NULL;
+  struct program *program;
+  int i, width, height, bits, depth, slots, workers;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--resolution")) {
+      if (i + 1 >= argc ||
+          sscanf(argv[++i], "%dx%d", &width, &height) != 2)
+        usage(argv[0]);
+      set_resolution(width, height);
+      cli_resolution = 1;
+    }
+    else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--depth")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      set_depth_format(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--light-cache")) {
+      if (i + 1 >= argc || sscanf(argv[++i], "%d", &bits) != 1)
+        usage(argv[0]);
+      set_light_cache_bits(bits);
+    }
+    else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--png")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      set_png_deflate(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--gif")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      set_gif_mode(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--frames")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      i++;
+      if (sscanf(argv[i], "%d-%d", &first_frame, &last_frame) != 2) {
+        if (sscanf(argv[i], "%d", &first_frame) != 1)
+          usage(argv[0]);
+        last_frame = first_frame;
       }
+      if (first_frame < 0 || last_frame < first_frame)
+        usage(argv[0]);
+    }
+    else if (!strcmp(argv[i], "--shard")) {
+      if (i + 1 >= argc ||
+          sscanf(argv[++i], "%d/%d", &shard, &shards) != 2 ||
+          shards < 1 || shard < 0 || shard >= shards)
+        usage(argv[0]);
+    }
+    else if (!strcmp(argv[i], "--no-animation"))
+      no_animation = 1;
+    else if (!strcmp(argv[i], "--cache")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      cache_directory = argv[++i];
     }
+    else if (!strcmp(argv[i], "--no-layers"))
+      no_layers = 1;
+    else if (!strcmp(argv[i], "--dump-program"))
+      dump_program = 1;
+    else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+      if (i + 1 >= argc || sscanf(argv[++i], "%d", &render_threads) != 1 ||
+          render_threads < 1 || render_threads > QUEUE_MAX_DEPTH)
+        usage(argv[0]);
+    }
+    else if (!strcmp(argv[i], "--farm")) {
+      if (i + 1 >= argc || sscanf(argv[++i], "%d", &workers) != 1)
+        usage(argv[0]);
+      set_farm_workers(workers);
+    }
+    else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--queue")) {
+      if (i + 1 >= argc || sscanf(argv[++i], "%d", &depth) != 1)
+        usage(argv[0]);
+      set_queue_depth(depth);
+    }
+    else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--stream")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      stream_target = argv[++i];
+      // Before anything is printed, so nothing but frames
+      // reaches the stream
+      if (!strcmp(stream_target, "-"))
+        take_stdout();
+    }
+    else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--stream-format")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      set_stream_format(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--shm")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      ring_name = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--shm-slots")) {
+      if (i + 1 >= argc || sscanf(argv[++i], "%d", &slots) != 1)
+        usage(argv[0]);
+      set_ring_slots(slots);
+    }
+    else if (!strcmp(argv[i], "--shm-full")) {
+      if (i + 1 >= argc)
+        usage(argv[0]);
+      set_ring_policy(argv[++i]);
+    }
+    else if (argv[i][0] == '-' || script != NULL)
+      usage(argv[0]);
+    else
+      script = argv[i];
   }
-  */
+  if (script == NULL)
+    usage(argv[0]);
 
-  yyin = fopen(argv[1], "r");
+  yyin = fopen(script, "r");
+  if (yyin == NULL) {
+    printf("Error: Cannot open %s\n", script);
+    exit(1);
+  }
 
+  init_materials();
   yyparse();
   //COMMENT OUT PRINT_PCODE AND UNCOMMENT
   //MY_MAIN IN ORDER TO RUN YOUR CODE
 
   //print_pcode();
+  if (dump_program) {
+    program = compile_program();
+    print_program(program);
+    free_program(program);
+    return 0;
+  }
   my_main();
 
   return 0;
@@ -6,5 +6,6 @@ void free_mesh(struct mesh *mesh_contents) {
   free(mesh_contents->points);
   free(mesh_contents->face_ords);
   free(mesh_contents->vert_norms);
+  free(mesh_contents->face_norms);
   free(mesh_contents);
 }
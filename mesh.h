@@ -5,6 +5,10 @@ struct mesh {
   struct matrix *points;  
   struct matrix *face_ords;
   struct matrix *vert_norms;
+  //vn index of each face corner, 0 where the face has none
+  struct matrix *face_norms;
+  //1 if every face corner has a valid vn
+  int has_normals;
 };
 
 void free_mesh(struct mesh *);
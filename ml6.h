@@ -2,7 +2,7 @@
 
 Header file for fucntions we will use in ml6
 
-Sets the maximum XYES and YRES for images as well
+Sets the default XRES and YRES for images as well
 as the maximum color value you want to use.
 
 Creates the point structure in order to represent 
@@ -11,10 +11,18 @@ a pixel as a color triple
 #ifndef ML6_H
 #define ML6_H
 
-#define XRES 500
-#define YRES 500
+#define DEFAULT_XRES 500
+#define DEFAULT_YRES 500
+#define MAX_RES 16384
 #define MAX_COLOR 255
 
+/*
+  The resolution is picked at runtime (command line or the
+  resolution command), see set_resolution() in display.c
+*/
+extern int xres;
+extern int yres;
+
 /*
   Every point has an individual int for
   each color value
@@ -24,7 +32,7 @@ struct point_t {
   int red;
   int green;
   int blue;
-} point_t;
+};
 
 /*
   We can now use color as a data type representing a point.
@@ -38,13 +46,24 @@ typedef struct point_t color;
 
 /*
   Likewise, we can use screen as a data type representing
-  an XRES x YRES array of colors.
+  an xres x yres block of colors. It is stored row by row,
+  so pixel (x, y) is s[y * xres + x].
   eg:
-  screen s;
-  s[0][0] = c;
+  screen s = new_screen();
+  s[0] = c;
+*/
+typedef struct point_t *screen;
+
+/*
+  The z-buffer is an xres x yres block of depths, laid out
+  the same way as screen. Each entry is 4 bytes, holding
+  either a float or a 24 bit fixed point depth depending
+  on depth_format (see display.h). Bigger z is closer.
 */
-typedef struct point_t screen[XRES][YRES];
+union depth {
+  float f;
+  unsigned int q;
+};
 
-//z-buffer is a 2d array of doubles to store z values
-typedef double zbuffer[XRES][YRES];
+typedef union depth *zbuffer;
 #endif
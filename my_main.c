@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "parser.h"
@@ -46,11 +47,20 @@
 #include "matrix.h"
 #include "ml6.h"
 #include "display.h"
+#include "gif.h"
+#include "queue.h"
+#include "stream.h"
+#include "ring.h"
+#include "farm.h"
+#include "cache.h"
+#include "program.h"
 #include "draw.h"
 #include "stack.h"
 #include "gmath.h"
 #include "obj_reader.h"
 #include "lights.h"
+#include "lighting.h"
+#include "material.h"
 
 
 /*======== void first_pass() ==========
@@ -58,7 +68,7 @@
   Returns:
 
   Checks the op array for any animation commands
-  (frames, basename, vary)
+  (frames, basename, vary) and for the resolution command
 
   Should set num_frames and basename if the frames
   or basename commands are present
@@ -92,6 +102,11 @@ void first_pass() {
     case VARY:
       vary_found++;
       break;
+    case RESOLUTION:
+      if (!cli_resolution)
+        set_resolution(op[i].op.resolution.width,
+                       op[i].op.resolution.height);
+      break;
     }
   }
 
@@ -121,96 +136,132 @@ void first_pass() {
   }
 }
 
-/* 
-Evalutes polynomial ax^3 + bx^2 + cx + d with val plugged in as x
-*/
-double trinomial(double val, double a, double b, double c, double d) {
-  return a*pow(val, 3) + b*pow(val, 2) + c*val + d;
+// A hermite vary is worked out exactly every this many frames
+#define VARY_ANCHOR 64
+
+/*======== double cubic() ==========
+  Inputs:   double *k
+            double x
+  Returns: k[0]x^3 + k[1]x^2 + k[2]x + k[3]
+  ====================*/
+static double cubic(double *k, double x) {
+  return k[0]*pow(x, 3) + k[1]*pow(x, 2) + k[2]*x + k[3];
 }
 
-/*======== struct vary_node ** second_pass() ==========
-  Inputs:
-  Returns: An array of vary_node linked lists
-
-  In order to set the knobs for animation, we need to keep
-  a separate value for each knob for each frame. We can do
-  this by using an array of linked lists. Each array index
-  will correspond to a frame (eg. knobs[0] would be the first
-  frame, knobs[2] would be the 3rd frame and so on).
-
-  Each index should contain a linked list of vary_nodes, each
-  node contains a knob name, a value, and a pointer to the
-  next node.
-
-  Go through the opcode array, and when you find vary, go
-  from knobs[0] to knobs[frames-1] and add (or modify) the
-  vary_node corresponding to the given knob with the
-  appropirate value.
+/*======== void vary_knob() ==========
+  Inputs:   struct command *v
+            double *knobs
+            char *varied
+  Returns:
+
+  Writes the values vary command v gives its knob into the
+  knob table, and marks them in varied.
+
+  The value steps evenly from start_val to end_val. With
+  hermite slopes given, each frame gets the hermite curve
+  through them at that value (at 1 minus it, going down)
+  instead. That is a cubic in the frame number, so it is
+  worked out by forward differencing, three additions a
+  frame, starting again from the curve itself every
+  VARY_ANCHOR frames so rounding errors don't build up.
+  The last frame, which the knob holds until it is varied
+  again, always comes from the curve itself.
+  Frames outside the animation are left out.
   ====================*/
-struct vary_node **second_pass() {
-  struct vary_node **arr_nodes = (struct vary_node **)calloc(num_frames, sizeof(struct vary_node *));
+static void vary_knob(struct command *v, double *knobs, char *varied) {
+  struct matrix *curve;
+  double k[4], cv, inc, u, du, val, f0, f1, f2, f3, d1, d2, d3;
+  int sf, ef, gh, j, i;
+  size_t cell;
+
+  sf = v->op.vary.start_frame;
+  ef = v->op.vary.end_frame;
+  gh = v->op.vary.given_hermite;
+  cv = v->op.vary.start_val;
+  inc = (v->op.vary.end_val - v->op.vary.start_val) / (ef - sf);
+
+  if (gh) {
+    curve = generate_curve_coefs(v->op.vary.start_val, v->op.vary.end_val,
+				 v->op.vary.start_hermite,
+				 v->op.vary.end_hermite, HERMITE);
+    for (i=0; i<4; i++)
+      k[i] = curve->m[i][0];
+    free_matrix(curve);
+  }
 
-  int sf, ef; // start frame, end frame
-  double sv, ev; // start val, end val
-  double sh, eh; // start hermite, end hermite
-  int gh; // whether or not given hermite values
+  d1 = d2 = d3 = f0 = 0;
+  for (j=sf; j<=ef; j++, cv+= inc) {
+    if (!gh)
+      val = cv;
+    else if (j == ef)
+      val = cubic(k, inc < 0 ? 1 - cv : cv);
+    else if ((j - sf) % VARY_ANCHOR == 0) {
+      u = inc < 0 ? 1 - cv : cv;
+      du = inc < 0 ? -inc : inc;
+      f0 = cubic(k, u);
+      f1 = cubic(k, u + du);
+      f2 = cubic(k, u + 2 * du);
+      f3 = cubic(k, u + 3 * du);
+      d1 = f1 - f0;
+      d2 = f2 - 2 * f1 + f0;
+      d3 = f3 - 3 * f2 + 3 * f1 - f0;
+      val = f0;
+    }
+    else {
+      f0+= d1;
+      d1+= d2;
+      d2+= d3;
+      val = f0;
+    }
 
-  int i;
-  for(i=0; i<lastop; i++) {
-    
-    double a, b, c, d;
-    if(op[i].opcode == VARY) {      
-      sf = op[i].op.vary.start_frame, ef = op[i].op.vary.end_frame;
-      sv = op[i].op.vary.start_val, ev = op[i].op.vary.end_val;
-      gh = op[i].op.vary.given_hermite;
-
-      if(gh) {
-	sh = op[i].op.vary.start_hermite, eh = op[i].op.vary.end_hermite;      
-	struct matrix *hem_coefs = generate_curve_coefs(sv, ev, sh, eh, HERMITE);      
-	a = hem_coefs->m[0][0];
-	b = hem_coefs->m[1][0];
-	c = hem_coefs->m[2][0];
-	d = hem_coefs->m[3][0];
-      }
-      
-      double cv = sv; // current knob value
-      double inc = (double)(ev - sv) / (ef - sf);
-      struct vary_node *vnode, *new_node;
-
-      double val; // value calculated for hermite curve
-      int j;      
-      for(j=sf; j<=ef; j++){
-	if(gh) 
-	  val = trinomial(cv, a, b, c, d); // plug into equation
-	else
-	  val = cv;
-
-	if(inc < 0)
-	  val = trinomial(1-cv, a, b, c, d);
-	
-	if(arr_nodes[j] == NULL) {
-	  vnode = (struct vary_node *)malloc(sizeof(struct vary_node));
-	  strncpy(vnode->name, op[i].op.vary.p->name, 128);
-	  vnode->value = val;
-	  vnode->next = NULL;
-	  arr_nodes[j] = vnode;
-	} else {
-	  vnode = arr_nodes[j];
-	  while(vnode->next != NULL)
-	    vnode = vnode->next;
-	  new_node = (struct vary_node *)malloc(sizeof(struct vary_node));
-	  vnode->next = new_node;
-	  new_node->next = NULL;
-	  strncpy(new_node->name, op[i].op.vary.p->name, 128);
-	  new_node->value = val;
-	}
-	
-	cv += inc;
-      }
+    if (j >= 0 && j < num_frames) {
+      cell = (size_t)j * lastknob + v->op.vary.p->knob;
+      knobs[cell] = val;
+      varied[cell] = 1;
     }
   }
+}
 
-  return arr_nodes;
+/*======== double *knob_table() ==========
+  Inputs:
+  Returns: every knob's value in every frame, num_frames
+  rows of lastknob values (one per knob, by its slot)
+
+  Knobs get their slots as the script is parsed. Each vary
+  fills in its knob's column for its frames, in script
+  order, so a later one wins where they overlap. A knob
+  keeps the last value it was given until it is varied
+  again, so the rest of each row comes from the row before,
+  and the first starts from the values the knobs were set
+  to. With the values worked out up front, frames can be
+  drawn in any order, at the same time, without touching
+  the symbol table.
+  ====================*/
+double *knob_table() {
+  double *knobs, *row;
+  char *varied;
+  size_t size;
+  int a, i;
+
+  size = (size_t)num_frames * lastknob;
+  knobs = (double *)malloc((size ? size : 1) * sizeof(double));
+  varied = (char *)calloc(size ? size : 1, 1);
+  for (i=0; i<lastop; i++)
+    if (op[i].opcode == VARY)
+      vary_knob(op + i, knobs, varied);
+
+  for (i=0; i<lastsym; i++)
+    if (symtab[i]->knob >= 0 && !varied[symtab[i]->knob])
+      knobs[symtab[i]->knob] =
+	symtab[i]->type == SYM_VALUE ? symtab[i]->s.value : 0;
+  for (a=1; a<num_frames; a++) {
+    row = knobs + (size_t)a * lastknob;
+    for (i=0; i<lastknob; i++)
+      if (!varied[(size_t)a * lastknob + i])
+	row[i] = row[i - lastknob];
+  }
+  free(varied);
+  return knobs;
 }
 
 /*======== void print_knobs() ==========
@@ -225,12 +276,651 @@ void print_knobs() {
 
   printf( "ID\tNAME\t\tTYPE\t\tVALUE\n" );
   for(i=0; i<lastsym; i++) {
-    if(symtab[i].type == SYM_VALUE) {
-      printf( "%d\t%s\t\t", i, symtab[i].name );
+    if(symtab[i]->type == SYM_VALUE) {
+      printf( "%d\t%s\t\t", i, symtab[i]->name );
       printf( "SYM_VALUE\t");
-      printf( "%6.2f\n", symtab[i].s.value);
+      printf( "%6.2f\n", symtab[i]->s.value);
+    }
+  }
+}
+
+/*======== struct shape *build_shape() ==========
+  Inputs:   int i
+  Returns: the shape drawn by op[i], or NULL if it doesn't
+  draw one
+
+  Shapes don't change between frames, so each one is built
+  (normals and all) once, before any frame is drawn, and
+  shared by every thread drawing frames.
+  ====================*/
+struct shape *build_shape(int i) {
+  struct shape *sh;
+  double step_3d = 30;
+
+  switch (op[i].opcode) {
+  case SPHERE:
+  case TORUS:
+  case BOX:
+  case MESH:
+    break;
+  default:
+    return NULL;
+  }
+
+  sh = new_shape();
+  if (op[i].opcode == SPHERE)
+    add_sphere(sh->polygons, op[i].op.sphere.d[0],
+	       op[i].op.sphere.d[1],
+	       op[i].op.sphere.d[2],
+	       op[i].op.sphere.r, step_3d);
+  else if (op[i].opcode == TORUS)
+    add_torus(sh->polygons,
+	      op[i].op.torus.d[0],
+	      op[i].op.torus.d[1],
+	      op[i].op.torus.d[2],
+	      op[i].op.torus.r0,op[i].op.torus.r1, step_3d);
+  else if (op[i].opcode == BOX)
+    add_box(sh->polygons,
+	    op[i].op.box.d0[0],op[i].op.box.d0[1],
+	    op[i].op.box.d0[2],
+	    op[i].op.box.d1[0],op[i].op.box.d1[1],
+	    op[i].op.box.d1[2]);
+  else
+    add_mesh(sh->polygons, sh->normals, op[i].op.mesh.name);
+  finish_shape(sh);
+  return sh;
+}
+
+// Where finished frames go besides their files
+struct frame_output {
+  struct gif_writer *gif;
+  struct stream *stream;
+  struct ring *ring;
+};
+
+/*======== void output_frame() ==========
+  Inputs:   void *data
+            int frame
+            unsigned char *rgb
+  Returns:
+
+  Gets every finished frame, packed and in order, and adds
+  it to the animation, the stream and the shared memory
+  ring in data, if there are any.
+  ====================*/
+static void output_frame(void *data, int frame, unsigned char *rgb) {
+  struct frame_output *out = (struct frame_output *)data;
+  if (out->gif != NULL)
+    add_gif_frame(out->gif, rgb);
+  if (out->stream != NULL)
+    write_stream_frame(out->stream, rgb);
+  if (out->ring != NULL)
+    publish_frame(out->ring, frame, rgb);
+}
+
+// Where each shape or line in the program is drawn (see
+// plan_layers()): every frame, once under everything else,
+// or once and laid over everything else
+#define LAYER_NONE 0
+#define LAYER_UNDER 1
+#define LAYER_OVER 2
+
+// A layer drawn ahead of time, with its depths
+struct layer {
+  screen s;
+  zbuffer zb;
+};
+
+// What the threads drawing frames share. Only next_frame
+// and the cache counts change once they start, under lock.
+// Frames next_frame (at the start) to last are drawn.
+struct render_job {
+  // The compiled script, and the shape each of its
+  // instructions draws (NULL for the rest)
+  struct program *program;
+  struct shape **shapes;
+  double *knobs;
+  struct frame_output *out;
+
+  // Frames are saved by the queue, or without it (one
+  // thread only) right here from screen, packed into rgb
+  // and passed to sink
+  struct frame_queue *queue;
+  screen screen;
+  unsigned char *rgb;
+  frame_sink sink;
+  void *sink_data;
+
+  // Picks each frame to draw, -1 when there are no more
+  int (*next)(struct render_job *job);
+  int next_frame, last;
+  long cache_lookups, cache_hits;
+  pthread_mutex_t lock;
+
+  // Each frame's key in the frame cache (NULL when it's
+  // off), and how many frames came from it
+  uint64_t *keys;
+  int reused;
+
+  // The layer of each instruction (NULL when everything is
+  // drawn every frame), and the layers, NULL if empty
+  char *layers;
+  struct layer *under, *over;
+
+  // A farm worker's socket, and the size of the pixels it
+  // sends back with each frame
+  int farm_fd;
+  size_t farm_pixels;
+};
+
+// Whether instruction i is drawn in the pass for layer
+static int in_layer(struct render_job *job, int i, int layer) {
+  return (job->layers == NULL ? LAYER_NONE : job->layers[i]) == layer;
+}
+
+// Hands out frames in order, to every thread drawing them
+static int next_in_order(struct render_job *job) {
+  int a;
+  pthread_mutex_lock(&job->lock);
+  a = job->next_frame++;
+  pthread_mutex_unlock(&job->lock);
+  return a;
+}
+
+// Puts the name of frame's file in path and returns it, or
+// NULL if frames aren't saved (when they're streamed)
+static char *frame_file(struct render_job *job, char *path, int frame) {
+  if (job->out->stream != NULL)
+    return NULL;
+  sprintf(path, "%s/%s%03d", DIRECTORY_NAME, name, frame);
+  return path;
+}
+
+/*======== void frame_done() ==========
+  Inputs:   void *data
+            int frame
+            unsigned char *rgb
+  Returns:
+
+  The sink for frames drawn here: once a frame is saved it
+  goes in the frame cache, then on to output_frame().
+  ====================*/
+static void frame_done(void *data, int frame, unsigned char *rgb) {
+  struct render_job *job = (struct render_job *)data;
+  char path[160];
+  if (job->keys != NULL && frame_file(job, path, frame) != NULL)
+    store_frame(job->keys[frame], path);
+  output_frame(job->out, frame, rgb);
+}
+
+/*======== void save_frame() ==========
+  Inputs:   struct render_job *job
+            int a
+            screen t
+            char *file
+  Returns:
+
+  Hands in finished frame a, drawn on t: to the queue, or
+  saved to file (unless it's NULL) and passed to the sink
+  right away.
+  ====================*/
+static void save_frame(struct render_job *job, int a, screen t, char *file) {
+  if (job->queue != NULL)
+    submit_frame(job->queue, a, file);
+  else {
+    if (file != NULL)
+      save_extension(t, file);
+    pack_rgb(t, job->rgb);
+    job->sink(job->sink_data, a, job->rgb);
+    clear_screen(t);
+  }
+}
+
+// Multiplies the top of systems by m (which is overwritten)
+static void apply_transform(struct stack *systems, struct matrix *m) {
+  matrix_mult(peek(systems), m);
+  copy_matrix(m, peek(systems));
+}
+
+/*======== void draw_ops() ==========
+  Inputs:   struct render_job *job
+            double *knobs
+            screen t
+            zbuffer zb
+            struct lighting *lighting
+            int layer
+  Returns:
+
+  Runs the program once with the knob values in knobs,
+  drawing on t and zb. Everything that sets up where things
+  are drawn runs, but only the shapes and lines in layer
+  (see plan_layers()) are drawn, or all of them if the job
+  has no layers.
+  ====================*/
+static void draw_ops(struct render_job *job, double *knobs, screen t,
+		     zbuffer zb, struct lighting *lighting, int layer) {
+  struct program *program = job->program;
+  struct instruction *ins;
+  struct matrix *edges, *transform, *m;
+  struct stack *systems;
+  double view[3], theta, scale;
+  color g;
+  int i;
+
+  g.red = 0;
+  g.green = 0;
+  g.blue = 0;
+
+  // View vector doesn't change
+  view[0] = 0;
+  view[1] = 0;
+  view[2] = 1;
+  setup_lights(lighting, view, program->ambient, program->light,
+	       program->lights);
+
+  systems = new_stack();
+  edges = new_matrix(4, 1000);
+  transform = new_matrix(4, 4);
+  transform->lastcol = 4;
+  for (i=0; i<program->count; i++) {
+    ins = program->code + i;
+
+    switch (ins->code) {
+    case INS_PUSH:
+      push(systems);
+      break;
+    case INS_POP:
+      pop(systems);
+      break;
+    case INS_TRANSFORM:
+      copy_matrix(ins->m, transform);
+      apply_transform(systems, transform);
+      break;
+    case INS_MOVE:
+      scale = knobs[ins->knob];
+      m = make_translate(ins->d[0] * scale, ins->d[1] * scale,
+			 ins->d[2] * scale);
+      apply_transform(systems, m);
+      free_matrix(m);
+      break;
+    case INS_SCALE:
+      scale = knobs[ins->knob];
+      m = make_scale(ins->d[0] * scale, ins->d[1] * scale,
+		     ins->d[2] * scale);
+      apply_transform(systems, m);
+      free_matrix(m);
+      break;
+    case INS_ROTATE:
+      theta = ins->d[0];
+      theta *= knobs[ins->knob];
+      theta *= (M_PI / 180);
+      if (ins->axis == 0)
+	m = make_rotX(theta);
+      else if (ins->axis == 1)
+	m = make_rotY(theta);
+      else
+	m = make_rotZ(theta);
+      apply_transform(systems, m);
+      free_matrix(m);
+      break;
+    case INS_DRAW:
+      if (!in_layer(job, i, layer))
+	break;
+      shading = ins->shading;
+      draw_polygons(job->shapes[i], peek(systems), t, zb, lighting,
+		    ins->material);
+      break;
+    case INS_LINE:
+      if (!in_layer(job, i, layer))
+	break;
+      add_edge(edges, ins->d[0], ins->d[1], ins->d[2],
+	       ins->d[3], ins->d[4], ins->d[5]);
+      matrix_mult(peek(systems), edges);
+      draw_lines(edges, t, zb, g);
+      edges->lastcol = 0;
+      break;
+    case INS_SAVE:
+      if (layer != LAYER_NONE)
+	break;
+      pthread_mutex_lock(&job->lock);
+      save_extension(t, ins->file);
+      pthread_mutex_unlock(&job->lock);
+      break;
+    case INS_DISPLAY:
+      if (layer != LAYER_NONE)
+	break;
+      pthread_mutex_lock(&job->lock);
+      display(t);
+      pthread_mutex_unlock(&job->lock);
+      break;
+    }
+  }
+
+  free_stack(systems);
+  free_matrix(edges);
+  free_matrix(transform);
+}
+
+// Whether program saves or displays a frame part way
+// through, which only happens if every command runs
+static int shows_partial_frames(struct program *program) {
+  int i;
+  for (i=0; i<program->count; i++)
+    if (program->code[i].code == INS_SAVE ||
+	program->code[i].code == INS_DISPLAY)
+      return 1;
+  return 0;
+}
+
+/*======== char *plan_layers() ==========
+  Inputs:   struct program *program
+            double *knobs
+            int first
+            int last
+  Returns: the layer of each of program's instructions, or
+  NULL if there's nothing worth drawing ahead of time
+
+  A shape or line is static if nothing that places it, the
+  moves, scales and rotates on the stack when it is drawn,
+  uses a knob that changes between frames first and last.
+  Lights and constants never change.
+
+  Drawing is in order, with a pixel going to whatever was
+  drawn last at least as close, and wireframes going over
+  anything. So static commands before the first one that
+  isn't go in the under layer, which every frame starts
+  from. Static commands after the last one that isn't, and
+  after the last wireframe, go in the over layer, which is
+  composited on top and comes out the same. Static ones in
+  between are still drawn every frame. SAVE and DISPLAY
+  show a frame part way through, so with either of them
+  everything is drawn every frame.
+  ====================*/
+static char *plan_layers(struct program *program, double *knobs,
+			 int first, int last) {
+  struct instruction *ins;
+  char *layers, *animated, *wire;
+  int *moving;
+  int i, a, k, top, first_moving, last_moving, cut, count;
+
+  if (shows_partial_frames(program))
+    return NULL;
+
+  animated = (char *)calloc(lastknob ? lastknob : 1, 1);
+  for (a=first+1; a<=last; a++)
+    for (k=0; k<lastknob; k++)
+      if (knobs[(size_t)a * lastknob + k] != knobs[(size_t)first * lastknob + k])
+	animated[k] = 1;
+
+  // moving[top] is whether the top of the stack moves
+  count = program->count ? program->count : 1;
+  layers = (char *)calloc(count, 1);
+  wire = (char *)calloc(count, 1);
+  moving = (int *)calloc(count + 1, sizeof(int));
+  top = 0;
+  first_moving = last_moving = -1;
+  for (i=0; i<program->count; i++) {
+    ins = program->code + i;
+    switch (ins->code) {
+    case INS_PUSH:
+      top++;
+      moving[top] = moving[top - 1];
+      break;
+    case INS_POP:
+      if (top > 0)
+	top--;
+      break;
+    case INS_MOVE:
+    case INS_SCALE:
+    case INS_ROTATE:
+      if (animated[ins->knob])
+	moving[top] = 1;
+      break;
+    case INS_DRAW:
+    case INS_LINE:
+      layers[i] = moving[top] ? LAYER_NONE : LAYER_UNDER;
+      wire[i] = ins->code == INS_DRAW && ins->shading == SHADE_WIREFRAME;
+      if (moving[top]) {
+	if (first_moving < 0)
+	  first_moving = i;
+	last_moving = i;
+      }
+      break;
+    }
+  }
+
+  cut = last_moving;
+  for (i=last_moving+1; first_moving >= 0 && i<program->count; i++)
+    if (wire[i])
+      cut = i;
+  count = 0;
+  for (i=0; i<program->count; i++) {
+    if (layers[i] == LAYER_UNDER && first_moving >= 0 && i > first_moving)
+      layers[i] = i > cut && !wire[i] ? LAYER_OVER : LAYER_NONE;
+    count+= layers[i] != LAYER_NONE;
+  }
+
+  free(animated);
+  free(wire);
+  free(moving);
+  if (!count) {
+    free(layers);
+    return NULL;
+  }
+  return layers;
+}
+
+/*======== struct layer *draw_layer() ==========
+  Inputs:   struct render_job *job
+            int layer
+            int first
+  Returns: what's in layer drawn on its own, using frame
+  first's knobs (any frame's would do), or NULL if nothing
+  is in it
+  ====================*/
+static struct layer *draw_layer(struct render_job *job, int layer, int first) {
+  struct layer *l;
+  struct lighting lighting;
+  int i;
+
+  for (i=0; i<job->program->count && !in_layer(job, i, layer); i++)
+    ;
+  if (i == job->program->count)
+    return NULL;
+
+  l = (struct layer *)malloc(sizeof(struct layer));
+  l->s = new_screen();
+  l->zb = new_zbuffer();
+  init_lighting(&lighting);
+  draw_ops(job, job->knobs + (size_t)first * lastknob, l->s, l->zb,
+	   &lighting, layer);
+  free_lighting(&lighting);
+  free_draw_buffers();
+  return l;
+}
+
+static void free_layer(struct layer *l) {
+  if (l == NULL)
+    return;
+  free_screen(l->s);
+  free_zbuffer(l->zb);
+  free(l);
+}
+
+/*======== void *render_frames() ==========
+  Inputs:   void *arg
+  Returns: NULL
+
+  Draws frames until there are none left, taking the one
+  job->next picks each time. Frames in the frame cache are
+  loaded from it instead of drawn. The rest start from the
+  under layer and get the over layer on top, if there are
+  any, so only what moves is drawn for them. Each thread running
+  this has its own z-buffer, origin stack and lighting,
+  and draws into the screen the queue gives it for the
+  frame, so any number can run at once. The program, the
+  shapes and the knob table are only read.
+  ====================*/
+static void *render_frames(void *arg) {
+
+  struct render_job *job = (struct render_job *)arg;
+  screen t;
+  zbuffer zb;
+  double *knobs;
+  struct lighting lighting;
+
+  init_lighting(&lighting);
+  zb = new_zbuffer();
+  t = job->screen;
+
+  int a;
+  char rel_file_path[160];
+  char *file;
+  while (1) {
+
+    a = job->next(job);
+    if (a < 0 || a > job->last)
+      break;
+
+    if (job->queue != NULL)
+      t = next_frame_screen(job->queue, a);
+    file = frame_file(job, rel_file_path, a);
+    if (file != NULL)
+      mkdir(DIRECTORY_NAME, 0744);
+    if (job->keys != NULL && file != NULL &&
+	reuse_frame(job->keys[a], file, t)) {
+      // Already saved, it only needs passing on
+      save_frame(job, a, t, NULL);
+      pthread_mutex_lock(&job->lock);
+      job->reused++;
+      pthread_mutex_unlock(&job->lock);
+      continue;
     }
+
+    knobs = job->knobs + (size_t)a * lastknob;
+    if (job->under != NULL)
+      copy_frame(t, zb, job->under->s, job->under->zb);
+    draw_ops(job, knobs, t, zb, &lighting, LAYER_NONE);
+    if (job->over != NULL)
+      composite_frame(t, zb, job->over->s, job->over->zb);
+
+    // Saving images into directory
+    save_frame(job, a, t, file);
+
+    // Reset z-buffer (the queue clears its own screens)
+    clear_zbuffer(zb);
+  }
+
+  pthread_mutex_lock(&job->lock);
+  job->cache_lookups += lighting.cache_lookups;
+  job->cache_hits += lighting.cache_hits;
+  pthread_mutex_unlock(&job->lock);
+
+  free_zbuffer(zb);
+  free_lighting(&lighting);
+  free_draw_buffers();
+  return NULL;
+}
+
+/*======== void draw_frames() ==========
+  Inputs:   struct render_job *job
+            int first
+  Returns:
+
+  Draws the job's frames in this process, from first, on
+  render_threads threads.
+  ====================*/
+static void draw_frames(struct render_job *job, int first) {
+  pthread_t *threads;
+  int i;
+
+  // Framebuffers are sized once the resolution is known and
+  // reused for every frame. With the queue on, each frame
+  // borrows a screen from it and the queue's threads save
+  // it while the next one renders. Drawing frames on more
+  // than one thread needs the queue, with a slot for each.
+  job->queue = NULL;
+  job->screen = NULL;
+  job->rgb = NULL;
+  if (render_threads > 1 && queue_depth < render_threads)
+    queue_depth = render_threads;
+  if (queue_depth > 0)
+    job->queue = new_frame_queue(queue_depth, first, frame_done, job);
+  else {
+    job->screen = new_screen();
+    job->rgb = (unsigned char *)malloc((size_t)xres * yres * 3);
+  }
+
+  if (render_threads > 1) {
+    threads = (pthread_t *)malloc(render_threads * sizeof(pthread_t));
+    for (i=0; i<render_threads; i++)
+      if (pthread_create(threads + i, NULL, render_frames, job)) {
+	printf("Error: could not start render thread\n");
+	exit(1);
+      }
+    for (i=0; i<render_threads; i++)
+      pthread_join(threads[i], NULL);
+    free(threads);
   }
+  else
+    render_frames(job);
+
+  if (job->queue != NULL)
+    finish_frame_queue(job->queue);
+  else {
+    free_screen(job->screen);
+    free(job->rgb);
+  }
+}
+
+// Prints the light cache stats, summed over every thread,
+// and how many frames came from the frame cache
+static void print_cache_stats(struct render_job *job) {
+  struct lighting lighting;
+  if (job->reused)
+    printf("Reused %d frames from the frame cache\n", job->reused);
+  init_lighting(&lighting);
+  lighting.cache_lookups = job->cache_lookups;
+  lighting.cache_hits = job->cache_hits;
+  print_light_cache_stats(&lighting);
+  free_lighting(&lighting);
+}
+
+// A farm worker's frames come from the coordinator
+static int next_farm_frame(struct render_job *job) {
+  return farm_next_frame(job->farm_fd);
+}
+
+// and go back to it once they're saved (and cached)
+static void send_farm_frame(void *data, int frame, unsigned char *rgb) {
+  struct render_job *job = (struct render_job *)data;
+  char path[160];
+  if (job->keys != NULL && frame_file(job, path, frame) != NULL)
+    store_frame(job->keys[frame], path);
+  farm_frame_done(job->farm_fd, frame, rgb, job->farm_pixels);
+}
+
+/*======== void draw_farm_frames() ==========
+  Inputs:   void *data
+            int fd
+  Returns:
+
+  Runs in each farm worker, with its own copy of the job:
+  draws and saves whatever frames the coordinator on fd
+  sends, one at a time, on this thread.
+  ====================*/
+static void draw_farm_frames(void *data, int fd) {
+  struct render_job *job = (struct render_job *)data;
+
+  job->farm_fd = fd;
+  job->next = next_farm_frame;
+  job->sink = send_farm_frame;
+  job->sink_data = job;
+  job->queue = NULL;
+  job->screen = new_screen();
+  job->rgb = (unsigned char *)malloc((size_t)xres * yres * 3);
+  render_frames(job);
+  print_cache_stats(job);
 }
 
 /*======== void my_main() ==========
@@ -262,411 +952,148 @@ void print_knobs() {
   ====================*/
 void my_main() {
 
-  int i;
-  struct matrix *tmp;
-  struct matrix *face_order;
-  struct stack *systems;
-  screen t;
-  zbuffer zb;
-  color g;
-  g.red = 0;
-  g.green = 0;
-  g.blue = 0;
-  double step_3d = 30;
-  double theta;
-  double knob_value, xval, yval, zval;
-
-  //variables for constants
-  SYMTAB * constant_dictionary[255];
-  int constant_dictionary_size = 0;
-  //
-
-  //Lighting values here for easy access    
-  color ambient;
-  double view[3];
-  double areflect[3];
-  double dreflect[3];
-  double sreflect[3];
-
-  // Supports up to MAX_LIGHTS light sources
-  double light[MAX_LIGHTS][2][3];
-
-  // Default ambient light if none specified:
-  ambient.red = 50;
-  ambient.green = 50;
-  ambient.blue = 50;
-
-  // Default location for light if none specified:
-  // (x, y, z) = (  1,   1,   1)
-  // (r, g, b) = (255, 255, 255)  
-  light[0][LOCATION][0] = 1;
-  light[0][LOCATION][1] = 1;
-  light[0][LOCATION][2] = 1;
-
-  light[0][COLOR][RED] = 255;
-  light[0][COLOR][GREEN] = 255;
-  light[0][COLOR][BLUE] = 255;
-
-  // View vector doesn't change
-  view[0] = 0;
-  view[1] = 0;
-  view[2] = 1;
-  
-  areflect[RED] = 0.1;
-  areflect[GREEN] = 0.1;
-  areflect[BLUE] = 0.1;
-
-  dreflect[RED] = 0.5;
-  dreflect[GREEN] = 0.5;
-  dreflect[BLUE] = 0.5;
-
-  sreflect[RED] = 0.5;
-  sreflect[GREEN] = 0.5;
-  sreflect[BLUE] = 0.5;
-
-  systems = new_stack();
-  tmp = new_matrix(4, 1000);
-  clear_screen(t);
-  clear_zbuffer(zb);
-
-  first_pass();  
-  struct vary_node **vary_nodes = second_pass();
-  
-  int a;
-  for(a=0; a<num_frames; a++) {
-
-    int light_count = 0;
-    SYMTAB *curr_sym;
-    struct vary_node *curr_node = vary_nodes[a];
+  int i, first, last, count, skipped;
+  uint64_t hash;
+  struct render_job job;
+  struct frame_output out;
+  char gif_name[160];
+
+  first_pass();
+
+  // The frames to draw: all of them, or the ones asked for
+  // with --frames, then split into even runs with --shard.
+  // Knobs come from a table of every frame, so any frame
+  // comes out the same as in a full run.
+  first = first_frame;
+  last = last_frame < 0 || last_frame >= num_frames ?
+    num_frames - 1 : last_frame;
+  if (first > last) {
+    printf("Error: Frame %d is past the last frame, %d\n",
+	   first, num_frames - 1);
+    exit(1);
+  }
+  count = last - first + 1;
+  last = first + (int)((long)count * (shard + 1) / shards) - 1;
+  first = first + (int)((long)count * shard / shards);
+  if (first > last) {
+    printf("Shard %d/%d has no frames\n", shard, shards);
+    return;
+  }
 
-    // Set symbol table
-    while(curr_node != NULL) {
-      curr_sym = lookup_symbol(curr_node->name);
-      set_value(curr_sym, curr_node->value);
-      curr_node = curr_node->next;
-    }
-    
-    knob_value = 1.0;
-    for(i=0; i<lastop; i++) {
-
-      switch (op[i].opcode) {
-      case SPHERE:
-	/* printf("Sphere: %6.2f %6.2f %6.2f r=%6.2f", */
-	/* 	 op[i].op.sphere.d[0],op[i].op.sphere.d[1], */
-	/* 	 op[i].op.sphere.d[2], */
-	/* 	 op[i].op.sphere.r); */
-	if (op[i].op.sphere.constants != NULL) {
-	    //printf("\tconstants: %s",op[i].op.sphere.constants->name);
-	    struct constants *cons = op[i].op.sphere.constants->s.c;
-	    areflect[RED] = cons->r[0];
-	    areflect[GREEN] = cons->g[0];
-	    areflect[BLUE] = cons->b[0];
-	    
-	    dreflect[RED] = cons->r[1];
-	    dreflect[GREEN] = cons->g[1];
-	    dreflect[BLUE] = cons->b[1];
-
-	    sreflect[RED] = cons->r[2];
-	    sreflect[GREEN] = cons->g[2];
-	    sreflect[BLUE] = cons->b[2];
-	}
-	if (op[i].op.sphere.cs != NULL) {
-	    //printf("\tcs: %s",op[i].op.sphere.cs->name);
-	}
-	add_sphere(tmp, op[i].op.sphere.d[0],
-		   op[i].op.sphere.d[1],
-		   op[i].op.sphere.d[2],
-		   op[i].op.sphere.r, step_3d);
-	matrix_mult( peek(systems), tmp );
-	draw_polygons(tmp, t, zb, view, light, ambient,
-		      areflect, dreflect, sreflect, light_count);
-	tmp->lastcol = 0;
-	break;
-      case TORUS:
-	/* printf("Torus: %6.2f %6.2f %6.2f r0=%6.2f r1=%6.2f", */
-	/* 	 op[i].op.torus.d[0],op[i].op.torus.d[1], */
-	/* 	 op[i].op.torus.d[2], */
-	/* 	 op[i].op.torus.r0,op[i].op.torus.r1); */
-	if (op[i].op.torus.constants != NULL) {
-	    //printf("\tconstants: %s",op[i].op.torus.constants->name);
-	    struct constants *cons = op[i].op.torus.constants->s.c;
-	    areflect[RED] = cons->r[0];
-	    areflect[GREEN] = cons->g[0];
-	    areflect[BLUE] = cons->b[0];
-	    
-	    dreflect[RED] = cons->r[1];
-	    dreflect[GREEN] = cons->g[1];
-	    dreflect[BLUE] = cons->b[1];
-
-	    sreflect[RED] = cons->r[2];
-	    sreflect[GREEN] = cons->g[2];
-	    sreflect[BLUE] = cons->b[2];
-	}
-	if (op[i].op.torus.cs != NULL) {
-	    //printf("\tcs: %s",op[i].op.torus.cs->name);
-	}
-	add_torus(tmp,
-		  op[i].op.torus.d[0],
-		  op[i].op.torus.d[1],
-		  op[i].op.torus.d[2],
-		  op[i].op.torus.r0,op[i].op.torus.r1, step_3d);
-	matrix_mult( peek(systems), tmp );
-	draw_polygons(tmp, t, zb, view, light, ambient,
-		      areflect, dreflect, sreflect, light_count);
-	tmp->lastcol = 0;
-	break;
-      case BOX:
-	/* printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f", */
-	/* 	 op[i].op.box.d0[0],op[i].op.box.d0[1], */
-	/* 	 op[i].op.box.d0[2], */
-	/* 	 op[i].op.box.d1[0],op[i].op.box.d1[1], */
-	/* 	 op[i].op.box.d1[2]); */
-	if (op[i].op.box.constants != NULL) {
-	    //printf("\tconstants: %s",op[i].op.box.constants->name);
-	  struct constants *cons = op[i].op.box.constants->s.c;
-	  areflect[RED] = cons->r[0];
-	  areflect[GREEN] = cons->g[0];
-	  areflect[BLUE] = cons->b[0];
-	    
-	  dreflect[RED] = cons->r[1];
-	  dreflect[GREEN] = cons->g[1];
-	  dreflect[BLUE] = cons->b[1];
-
-	  sreflect[RED] = cons->r[2];
-	  sreflect[GREEN] = cons->g[2];
-	  sreflect[BLUE] = cons->b[2];
-	}
-	if (op[i].op.box.cs != NULL) {
-	    //printf("\tcs: %s",op[i].op.box.cs->name);
-	}
-	add_box(tmp,
-		op[i].op.box.d0[0],op[i].op.box.d0[1],
-		op[i].op.box.d0[2],
-		op[i].op.box.d1[0],op[i].op.box.d1[1],
-		op[i].op.box.d1[2]);
-	matrix_mult(peek(systems), tmp);
-	draw_polygons(tmp, t, zb, view, light, ambient,
-		      areflect, dreflect, sreflect, light_count);
-	tmp->lastcol = 0;
-	break;
-      case MESH:
-	if (op[i].op.mesh.constants != NULL) {
-	    //printf("\tconstants: %s",op[i].op.box.constants->name);
-	  struct constants *cons = op[i].op.mesh.constants->s.c;
-	  areflect[RED] = cons->r[0];
-	  areflect[GREEN] = cons->g[0];
-	  areflect[BLUE] = cons->b[0];
-	    
-	  dreflect[RED] = cons->r[1];
-	  dreflect[GREEN] = cons->g[1];
-	  dreflect[BLUE] = cons->b[1];
-
-	  sreflect[RED] = cons->r[2];
-	  sreflect[GREEN] = cons->g[2];
-	  sreflect[BLUE] = cons->b[2];
-	}
-	if (op[i].op.mesh.cs != NULL) {
-	    //printf("\tcs: %s",op[i].op.box.cs->name);
-	}
-	add_mesh(tmp, op[i].op.mesh.name);
-	matrix_mult(peek(systems), tmp);
-	draw_polygons(tmp, t, zb, view, light, ambient,
-		      areflect, dreflect, sreflect, light_count);
-	tmp->lastcol = 0;	
-	break;	  
-      case LINE:
-	/* printf("Line: from: %6.2f %6.2f %6.2f to: %6.2f %6.2f %6.2f",*/
-	/* 	 op[i].op.line.p0[0],op[i].op.line.p0[1], */
-	/* 	 op[i].op.line.p0[1], */
-	/* 	 op[i].op.line.p1[0],op[i].op.line.p1[1], */
-	/* 	 op[i].op.line.p1[1]); */
-	if (op[i].op.line.constants != NULL)
-	  {
-	    //printf("\n\tConstants: %s",op[i].op.line.constants->name);
-	  }
-	if (op[i].op.line.cs0 != NULL)
-	  {
-	    //printf("\n\tCS0: %s",op[i].op.line.cs0->name);
-	  }
-	if (op[i].op.line.cs1 != NULL)
-	  {
-	    //printf("\n\tCS1: %s",op[i].op.line.cs1->name);
-	  }
-	add_edge(tmp,
-		 op[i].op.line.p0[0],op[i].op.line.p0[1],
-		 op[i].op.line.p0[2],
-		 op[i].op.line.p1[0],op[i].op.line.p1[1],
-		 op[i].op.line.p1[2]);
-	matrix_mult( peek(systems), tmp );
-	draw_lines(tmp, t, zb, g);
-	tmp->lastcol = 0;
-	break;
-      case MOVE:
-	xval = op[i].op.move.d[0];
-	yval = op[i].op.move.d[1];
-	zval = op[i].op.move.d[2];
-	printf("Move: %6.2f %6.2f %6.2f",
-	       xval, yval, zval);
-	
-	if (op[i].op.move.p != NULL) {
-	  printf("\tknob: %s",op[i].op.move.p->name);
-	  SYMTAB *curr_sym = lookup_symbol(op[i].op.move.p->name);
-	  knob_value = curr_sym->s.value;
-	  xval *= knob_value;
-	  yval *= knob_value;
-	  zval *= knob_value;
-	}
-	tmp = make_translate( xval, yval, zval );
-	matrix_mult(peek(systems), tmp);
-	copy_matrix(tmp, peek(systems));
-	tmp->lastcol = 0;
-	break;
-      case SCALE:
-	xval = op[i].op.scale.d[0];
-	yval = op[i].op.scale.d[1];
-	zval = op[i].op.scale.d[2];
-	printf("Scale: %6.2f %6.2f %6.2f",
-	       xval, yval, zval);
-	if (op[i].op.scale.p != NULL) {
-	  printf("\tknob: %s",op[i].op.scale.p->name);
-	  SYMTAB *curr_sym = lookup_symbol(op[i].op.scale.p->name);
-	  knob_value = curr_sym->s.value;
-	  xval *= knob_value;
-	  yval *= knob_value;
-	  zval *= knob_value;
-	}
-	tmp = make_scale( xval, yval, zval );
-	matrix_mult(peek(systems), tmp);
-	copy_matrix(tmp, peek(systems));
-	tmp->lastcol = 0;
-	break;
-      case ROTATE:
-	xval = op[i].op.rotate.axis;
-	theta = op[i].op.rotate.degrees;
-	printf("Rotate: axis: %6.2f degrees: %6.2f",
-	       xval, theta);
-	if (op[i].op.rotate.p != NULL) {
-	  printf("\tknob: %s",op[i].op.rotate.p->name);
-	  SYMTAB *curr_sym = lookup_symbol(op[i].op.rotate.p->name);
-	  knob_value = curr_sym->s.value;
-	  theta *= knob_value;
-	}	
-	theta *= (M_PI / 180);
-	if (op[i].op.rotate.axis == 0 )
-	  tmp = make_rotX( theta );
-	else if (op[i].op.rotate.axis == 1 )
-	  tmp = make_rotY( theta );
-	else
-	  tmp = make_rotZ( theta );
-
-	matrix_mult(peek(systems), tmp);
-	copy_matrix(tmp, peek(systems));
-	tmp->lastcol = 0;
-	break;
-      case AMBIENT:
-	ambient.red = op[i].op.ambient.c[0];
-	ambient.green = op[i].op.ambient.c[1];
-	ambient.blue = op[i].op.ambient.c[2];
-	break;
-      case LIGHT:
-	if(light_count < MAX_LIGHTS) {
-	  struct light *lgt = op[i].op.light.p->s.l;
-	  (light[light_count])[LOCATION][0] = lgt->l[0];
-	  (light[light_count])[LOCATION][1] = lgt->l[1];
-	  (light[light_count])[LOCATION][2] = lgt->l[2];
-	  
-	  (light[light_count])[COLOR][RED] = lgt->c[0];
-	  (light[light_count])[COLOR][GREEN] = lgt->c[1];
-	  (light[light_count])[COLOR][BLUE] = lgt->c[2];
-	  
-	  light_count++;
-	}
-	break;
-      case CONSTANTS:
-	; // don't remove this semicolon
-
-	//op[i].op.constants.p->name;
-	
-	
-	/*
-	char * name = op[i].op.constants.p->name;
-
-	
-	struct constants *cons;
-
-	int ii;
-	for(ii = 0; ii < constant_dictionary_size; ii++){
-        if(strcmp(name,constant_dictionary[ii]->name) == 0){
-            //if constant is already defined
-            cons = constant_dictionary[ii]->s.c;
-            break;
-        }
-      }
-      if(ii >= constant_dictionary_size){
-          //if constant is not defined
-          cons = op[i].op.constants.p->s.c;
-          constant_dictionary[constant_dictionary_size] = op[i].op.constants.p;
-          constant_dictionary_size++;
-      }
-	
-      view[0] = cons->r[0];
-      view[1] = cons->g[0];
-      view[2] = cons->b[0];
-
-      areflect[RED]   = cons->r[1];
-      areflect[GREEN] = cons->g[1];
-      areflect[BLUE]  = cons->b[1];
-	
-      dreflect[RED]   = cons->r[2];
-      dreflect[GREEN] = cons->g[2];
-      dreflect[BLUE]  = cons->b[2];
-
-      sreflect[RED]   = cons->r[3];
-      sreflect[GREEN] = cons->g[3];
-      sreflect[BLUE]  = cons->b[3];	
-	*/
-      break;
-      case PUSH:
-	//printf("Push");
-	push(systems);
-	break;
-      case POP:
-	//printf("Pop");
-	pop(systems);
-	break;
-      case SAVE:
-	//printf("Save: %s",op[i].op.save.p->name);
-	save_extension(t, op[i].op.save.p->name);
-	break;
-      case DISPLAY:
-	//printf("Display");
-	display(t);
-	break;
-      } //end opcode switch      
+  // An animation of part of the frames is named for them,
+  // convert is only run on all of them
+  if (first > 0 || last < num_frames - 1) {
+    printf("Drawing frames %d to %d\n", first, last);
+    if (gif_mode == GIF_CONVERT)
+      no_animation = 1;
+  }
 
-      printf("\n");
-    }//end operation loop
-    
-    // Saving images into directory
-    char rel_file_path[128];
-    mkdir(DIRECTORY_NAME, 0744);
-    sprintf(rel_file_path, "%s/%s%03d", DIRECTORY_NAME, name, a);
-    save_extension(t, rel_file_path);
+  // A stream takes the place of the frame files and the
+  // animation. Otherwise, unless convert is making it
+  // afterwards, the animation is written as the frames are
+  // rendered.
+  out.gif = NULL;
+  out.stream = NULL;
+  out.ring = NULL;
+  if (stream_target != NULL)
+    out.stream = open_stream(stream_target, xres, yres);
+  else if (!no_animation && gif_mode != GIF_CONVERT) {
+    if (first > 0 || last < num_frames - 1)
+      sprintf(gif_name, "%s%03d-%03d.gif", name, first, last);
+    else
+      sprintf(gif_name, "%s.gif", name);
+    printf("Making animation: %s\n", gif_name);
+    out.gif = open_gif(gif_name, xres, yres, GIF_DELAY);
+  }
+  // Frames are also shared with local tools as they finish
+  if (ring_name != NULL)
+    out.ring = open_ring(ring_name, xres, yres);
+
+  job.program = compile_program();
+  job.shapes = (struct shape **)calloc(job.program->count + 1,
+				       sizeof(struct shape *));
+  for (i=0; i<job.program->count; i++)
+    job.shapes[i] = build_shape(job.program->code[i].op);
+  job.knobs = knob_table();
+  job.out = &out;
+  job.sink = frame_done;
+  job.sink_data = &job;
+  job.next = next_in_order;
+  job.next_frame = first;
+  job.last = last;
+  job.cache_lookups = job.cache_hits = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  skipped = 0;
+
+  // Frames are only cached as files, so not when streamed.
+  // A frame from the cache isn't drawn, so scripts that
+  // save or display it part way through aren't cached.
+  job.keys = NULL;
+  job.reused = 0;
+  if (out.stream != NULL || shows_partial_frames(job.program))
+    cache_directory = NULL;
+  open_frame_cache();
+  if (cache_directory != NULL) {
+    hash = hash_program();
+    job.keys = (uint64_t *)malloc(num_frames * sizeof(uint64_t));
+    for (i=0; i<num_frames; i++)
+      job.keys[i] = frame_key(hash, job.knobs + (size_t)i * lastknob,
+			      lastknob);
+  }
 
-    // Reset screen and z-buffer
-    clear_zbuffer(zb);
-    clear_screen(t);
-    
-    // Reset stack
-    free_stack(systems);
-    systems = new_stack();
-
-    // Reset temp matrix
-    free(tmp);
-    tmp = new_matrix(4, 1000);
+  // Whatever doesn't move is drawn once, before any frame
+  job.layers = no_layers ? NULL :
+    plan_layers(job.program, job.knobs, first, last);
+  job.under = job.over = NULL;
+  if (job.layers != NULL) {
+    count = 0;
+    for (i=0; i<job.program->count; i++)
+      count+= job.layers[i] != LAYER_NONE;
+    printf("Drawing %d static commands once\n", count);
+    job.under = draw_layer(&job, LAYER_UNDER, first);
+    job.over = draw_layer(&job, LAYER_OVER, first);
   }
 
-  make_animation(name); // Auto-create GIF
+  // With --farm, the frames are drawn by worker processes,
+  // forked now that the script is parsed and the shapes and
+  // knobs are ready. Pixels only come back if something
+  // here needs them.
+  if (farm_workers > 0) {
+    job.farm_pixels = out.gif || out.stream || out.ring ?
+      (size_t)xres * yres * 3 : 0;
+    skipped = run_farm(farm_workers, first, last, draw_farm_frames, &job,
+		       job.farm_pixels,
+		       job.farm_pixels ? output_frame : NULL, &out);
+  }
+  else {
+    draw_frames(&job, first);
+    print_cache_stats(&job);
+  }
 
+  for (i=0; i<job.program->count; i++)
+    if (job.shapes[i] != NULL)
+      free_shape(job.shapes[i]);
+  free(job.shapes);
+  free_program(job.program);
+  free(job.knobs);
+  free(job.keys);
+  free(job.layers);
+  free_layer(job.under);
+  free_layer(job.over);
+  pthread_mutex_destroy(&job.lock);
+
+  if (out.ring != NULL)
+    close_ring(out.ring);
+  if (out.stream != NULL)
+    close_stream(out.stream);
+  else if (out.gif != NULL)
+    close_gif(out.gif);
+  else if (!no_animation)
+    make_animation(name); // Auto-create GIF
+
+  if (skipped) {
+    printf("Error: %d frames were skipped\n", skipped);
+    exit(1);
+  }
   printf("Finished!\n");
 }
@@ -14,22 +14,26 @@
 */
 int read_obj_file(char *path, struct mesh *mh) {
 
-  struct matrix *mat, *face_ord, *vert_norms;
+  struct matrix *mat, *face_ord, *vert_norms, *face_norms;
   
   mat = mh->points;
   face_ord = mh->face_ords;
   vert_norms = mh->vert_norms;
+  face_norms = mh->face_norms;
+  mh->has_normals = 1;
   
   FILE *fp = fopen(path, "r");
   char *line = NULL;
   size_t read, len = 0;
 
-  if (fp == NULL)
+  if (fp == NULL) {
     printf("Error: Cannot read .obj file!\n");
+    return 0;
+  }
 
   double d_params[4], d_params2[3];
-  int i_params[4];
-  i_params[3] = 0;
+  int i_params[4], n_params[4];
+  char *end;
 
   int count;
   while ((read = getline(&line, &len, fp)) != -1) {    
@@ -51,16 +55,34 @@ int read_obj_file(char *path, struct mesh *mh) {
       mat->lastcol++;
     } else if (strcmp(s, "f") == 0) {
       
-      // face code
-      while((s = strtok(NULL, " ")) != NULL)
-	i_params[count++] = atoi(s);
-      if (face_ord->lastcol == face_ord->cols)
+      // face code, each corner is v, v/vt, v//vn or v/vt/vn
+      i_params[3] = n_params[3] = 0;
+      while((s = strtok(NULL, " \t\r\n")) != NULL && count < 4) {
+	i_params[count] = strtol(s, &end, 10);
+	n_params[count] = 0;
+	if (*end == '/') {
+	  strtol(end + 1, &end, 10);
+	  if (*end == '/')
+	    n_params[count] = strtol(end + 1, &end, 10);
+	}
+	if (n_params[count] <= 0)
+	  mh->has_normals = 0;
+	count++;
+      }
+      if (face_ord->lastcol == face_ord->cols) {
 	grow_matrix(face_ord, face_ord->lastcol + 100);
+	grow_matrix(face_norms, face_ord->lastcol + 100);
+      }
       face_ord->m[0][face_ord->lastcol] = (double)i_params[0];
       face_ord->m[1][face_ord->lastcol] = (double)i_params[1];
       face_ord->m[2][face_ord->lastcol] = (double)i_params[2];
       face_ord->m[3][face_ord->lastcol] = (double)i_params[3];
+      face_norms->m[0][face_ord->lastcol] = (double)n_params[0];
+      face_norms->m[1][face_ord->lastcol] = (double)n_params[1];
+      face_norms->m[2][face_ord->lastcol] = (double)n_params[2];
+      face_norms->m[3][face_ord->lastcol] = (double)n_params[3];
       face_ord->lastcol++;
+      face_norms->lastcol++;
     } else if (strcmp(s, "vn") == 0) {
       
       // vertex normal code
@@ -82,6 +104,18 @@ int read_obj_file(char *path, struct mesh *mh) {
   
   if(line)
     free(line);
+
+  // Normals are only usable if every face has them and
+  // they all point at a vn that exists
+  if (face_ord->lastcol == 0)
+    mh->has_normals = 0;
+  for (count = 0; mh->has_normals && count < face_norms->lastcol; count++)
+    if (face_norms->m[0][count] > vert_norms->lastcol ||
+        face_norms->m[1][count] > vert_norms->lastcol ||
+        face_norms->m[2][count] > vert_norms->lastcol ||
+        face_norms->m[3][count] > vert_norms->lastcol)
+      mh->has_normals = 0;
+  return 1;
 }
 
 /*
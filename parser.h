@@ -101,6 +101,9 @@ struct command {
     struct {
       double num_frames;
     } frames;
+    struct {
+      double width, height;
+    } resolution;
     struct {
       SYMTAB *p;
       double given_hermite;
@@ -124,19 +127,22 @@ struct command {
 extern struct command op[MAX_COMMANDS];
 
 //Code generator headers
-int num_frames;
-char name[128];
-
-struct vary_node {  
-  char name[128];
-  double value;
-  struct vary_node *next;
-};
+extern int num_frames;
+extern char name[128];
+extern int cli_resolution; //set when -r was given, the script can't override it
+extern int render_threads; //frames drawn at once, set by -j
+//frames to draw, last_frame -1 for the end, then which of how
+//many even parts of those, and whether to skip the animation
+extern int first_frame, last_frame;
+extern int shard, shards;
+extern int no_animation;
+extern int no_layers; //set by --no-layers, draws static commands every frame
+extern int dump_program; //set by --dump-program, prints the compiled program instead
 
 void print_knobs();
 void process_knobs();
 void first_pass();
-struct vary_node ** second_pass();
+double *knob_table();
 void print_pcode();
 void my_main();
 #endif
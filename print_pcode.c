@@ -161,6 +161,11 @@ void print_pcode()
 	case FRAMES:
 	  printf("Num frames: %4.0f",op[i].op.frames.num_frames);
 	  break;
+	case RESOLUTION:
+	  printf("Resolution: %4.0f %4.0f",
+		 op[i].op.resolution.width,
+		 op[i].op.resolution.height);
+	  break;
 	case VARY:
 	  printf("Vary: %4.0f %4.0f, %4.0f %4.0f",
 		 op[i].op.vary.start_frame,
@@ -0,0 +1,294 @@
+/*====================== program.c ========================
+Compiles the parsed script into the program every frame
+runs, and prints it for --dump-program (see program.h).
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "parser.h"
+#include "symtab.h"
+#include "y.tab.h"
+#include "ml6.h"
+#include "matrix.h"
+#include "gmath.h"
+#include "draw.h"
+#include "material.h"
+#include "program.h"
+
+/*======== int material_of() ==========
+Inputs:   SYMTAB *constants
+Returns:  the material a shape's constants were
+compiled to, or the default material if it has none
+====================*/
+static int material_of( SYMTAB *constants ) {
+  return constants ? constants->s.c->material : DEFAULT_MATERIAL;
+}
+
+//the knob column of p, -1 without a knob
+static int knob_of( SYMTAB *p ) {
+  return p ? p->knob : -1;
+}
+
+/*======== void add_light() ==========
+Inputs:   struct program *p
+         struct light *l
+Returns:
+Adds l to p's lights, if there's room for it.
+====================*/
+static void add_light( struct program *p, struct light *l ) {
+
+  if ( p->lights >= MAX_LIGHTS )
+    return;
+  p->light[p->lights][LOCATION][0] = l->l[0];
+  p->light[p->lights][LOCATION][1] = l->l[1];
+  p->light[p->lights][LOCATION][2] = l->l[2];
+  p->light[p->lights][COLOR][RED] = l->c[0];
+  p->light[p->lights][COLOR][GREEN] = l->c[1];
+  p->light[p->lights][COLOR][BLUE] = l->c[2];
+  p->lights++;
+}
+
+/*======== struct program *compile_program() ==========
+Inputs:
+Returns: op[] compiled into a new program
+
+Without an ambient command the ambient light is 50 50 50,
+and without any lights there is one white light at 1 1 1.
+Shapes and lines are drawn in flat shading until a shading
+command says otherwise.
+====================*/
+struct program *compile_program() {
+
+  struct program *p;
+  struct instruction *ins;
+  double theta;
+  int i, shading;
+
+  p = (struct program *)malloc(sizeof(struct program));
+  p->code = (struct instruction *)calloc(lastop ? lastop : 1,
+                                         sizeof(struct instruction));
+  p->count = 0;
+  p->ambient.red = 50;
+  p->ambient.green = 50;
+  p->ambient.blue = 50;
+  p->lights = 0;
+
+  shading = SHADE_FLAT;
+  for ( i = 0; i < lastop; i++ ) {
+    ins = p->code + p->count;
+    ins->op = i;
+    ins->knob = -1;
+    switch ( op[i].opcode ) {
+    case PUSH:
+      ins->code = INS_PUSH;
+      break;
+    case POP:
+      ins->code = INS_POP;
+      break;
+    case MOVE:
+      ins->code = INS_MOVE;
+      ins->knob = knob_of(op[i].op.move.p);
+      ins->d[0] = op[i].op.move.d[0];
+      ins->d[1] = op[i].op.move.d[1];
+      ins->d[2] = op[i].op.move.d[2];
+      if ( ins->knob < 0 ) {
+        ins->code = INS_TRANSFORM;
+        ins->m = make_translate(ins->d[0], ins->d[1], ins->d[2]);
+      }
+      break;
+    case SCALE:
+      ins->code = INS_SCALE;
+      ins->knob = knob_of(op[i].op.scale.p);
+      ins->d[0] = op[i].op.scale.d[0];
+      ins->d[1] = op[i].op.scale.d[1];
+      ins->d[2] = op[i].op.scale.d[2];
+      if ( ins->knob < 0 ) {
+        ins->code = INS_TRANSFORM;
+        ins->m = make_scale(ins->d[0], ins->d[1], ins->d[2]);
+      }
+      break;
+    case ROTATE:
+      ins->code = INS_ROTATE;
+      ins->knob = knob_of(op[i].op.rotate.p);
+      ins->axis = op[i].op.rotate.axis;
+      ins->d[0] = op[i].op.rotate.degrees;
+      if ( ins->knob < 0 ) {
+        ins->code = INS_TRANSFORM;
+        theta = ins->d[0] * (M_PI / 180);
+        if ( ins->axis == 0 )
+          ins->m = make_rotX(theta);
+        else if ( ins->axis == 1 )
+          ins->m = make_rotY(theta);
+        else
+          ins->m = make_rotZ(theta);
+      }
+      break;
+    case SPHERE:
+      ins->code = INS_DRAW;
+      ins->material = material_of(op[i].op.sphere.constants);
+      break;
+    case TORUS:
+      ins->code = INS_DRAW;
+      ins->material = material_of(op[i].op.torus.constants);
+      break;
+    case BOX:
+      ins->code = INS_DRAW;
+      ins->material = material_of(op[i].op.box.constants);
+      break;
+    case MESH:
+      ins->code = INS_DRAW;
+      ins->material = material_of(op[i].op.mesh.constants);
+      break;
+    case LINE:
+      ins->code = INS_LINE;
+      ins->d[0] = op[i].op.line.p0[0];
+      ins->d[1] = op[i].op.line.p0[1];
+      ins->d[2] = op[i].op.line.p0[2];
+      ins->d[3] = op[i].op.line.p1[0];
+      ins->d[4] = op[i].op.line.p1[1];
+      ins->d[5] = op[i].op.line.p1[2];
+      break;
+    case SHADING:
+      shading = parse_shading(op[i].op.shading.p->name);
+      break;
+    case AMBIENT:
+      p->ambient.red = op[i].op.ambient.c[0];
+      p->ambient.green = op[i].op.ambient.c[1];
+      p->ambient.blue = op[i].op.ambient.c[2];
+      break;
+    case LIGHT:
+      add_light(p, op[i].op.light.p->s.l);
+      break;
+    case SAVE:
+      ins->code = INS_SAVE;
+      ins->file = op[i].op.save.p->name;
+      break;
+    case DISPLAY:
+      ins->code = INS_DISPLAY;
+      break;
+    }
+    ins->shading = shading;
+    if ( ins->code )
+      p->count++;
+  }
+
+  if ( p->lights == 0 ) {
+    p->light[0][LOCATION][0] = 1;
+    p->light[0][LOCATION][1] = 1;
+    p->light[0][LOCATION][2] = 1;
+    p->light[0][COLOR][RED] = 255;
+    p->light[0][COLOR][GREEN] = 255;
+    p->light[0][COLOR][BLUE] = 255;
+    p->lights = 1;
+  }
+  return p;
+}
+
+/*======== void free_program() ==========
+Inputs:   struct program *p
+Returns:
+Frees p and the matrices it made.
+====================*/
+void free_program( struct program *p ) {
+
+  int i;
+
+  for ( i = 0; i < p->count; i++ )
+    if ( p->code[i].m != NULL )
+      free_matrix(p->code[i].m);
+  free(p->code);
+  free(p);
+}
+
+//the name of the command that made ins
+static char *source_name( struct instruction *ins ) {
+
+  switch ( op[ins->op].opcode ) {
+  case SPHERE:
+    return "sphere";
+  case TORUS:
+    return "torus";
+  case BOX:
+    return "box";
+  case MESH:
+    return "mesh";
+  case MOVE:
+    return "move";
+  case SCALE:
+    return "scale";
+  case ROTATE:
+    return "rotate";
+  }
+  return "";
+}
+
+/*======== void print_program() ==========
+Inputs:   struct program *p
+Returns:
+Prints p, an instruction a line, each with the number of
+the command it came from.
+====================*/
+void print_program( struct program *p ) {
+
+  static char *shading_names[] = { "wireframe", "flat", "gouraud", "phong" };
+  static char axes[] = "xyz";
+  struct instruction *ins;
+  int i, r;
+
+  printf("Ambient: %6.2f %6.2f %6.2f\n",
+         (double)p->ambient.red, (double)p->ambient.green,
+         (double)p->ambient.blue);
+  for ( i = 0; i < p->lights; i++ )
+    printf("Light %d: at %6.2f %6.2f %6.2f color %6.2f %6.2f %6.2f\n", i,
+           p->light[i][LOCATION][0], p->light[i][LOCATION][1],
+           p->light[i][LOCATION][2], p->light[i][COLOR][RED],
+           p->light[i][COLOR][GREEN], p->light[i][COLOR][BLUE]);
+  printf("%d instructions from %d commands\n", p->count, lastop);
+
+  for ( i = 0; i < p->count; i++ ) {
+    ins = p->code + i;
+    printf("%4d [%4d] ", i, ins->op);
+    switch ( ins->code ) {
+    case INS_PUSH:
+      printf("push");
+      break;
+    case INS_POP:
+      printf("pop");
+      break;
+    case INS_TRANSFORM:
+      printf("transform (%s)", source_name(ins));
+      for ( r = 0; r < 4; r++ )
+        printf(" | %6.2f %6.2f %6.2f %6.2f", ins->m->m[r][0],
+               ins->m->m[r][1], ins->m->m[r][2], ins->m->m[r][3]);
+      break;
+    case INS_MOVE:
+    case INS_SCALE:
+      printf("%s %6.2f %6.2f %6.2f * knob %d (%s)", source_name(ins),
+             ins->d[0], ins->d[1], ins->d[2], ins->knob,
+             ins->code == INS_MOVE ? op[ins->op].op.move.p->name :
+             op[ins->op].op.scale.p->name);
+      break;
+    case INS_ROTATE:
+      printf("rotate %c %6.2f * knob %d (%s)", axes[ins->axis % 3],
+             ins->d[0], ins->knob, op[ins->op].op.rotate.p->name);
+      break;
+    case INS_DRAW:
+      printf("draw %s material %d %s", source_name(ins), ins->material,
+             shading_names[ins->shading]);
+      break;
+    case INS_LINE:
+      printf("line %6.2f %6.2f %6.2f to %6.2f %6.2f %6.2f",
+             ins->d[0], ins->d[1], ins->d[2], ins->d[3], ins->d[4], ins->d[5]);
+      break;
+    case INS_SAVE:
+      printf("save %s", ins->file);
+      break;
+    case INS_DISPLAY:
+      printf("display");
+      break;
+    }
+    printf("\n");
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "ml6.h"
+#include "matrix.h"
+#include "lights.h"
+
+/*
+  The script, compiled for drawing frames. compile_program()
+  goes through op[] once, after parsing, and keeps only
+  what each frame does, in order, with everything that is
+  the same in every frame worked out already: symbols are
+  looked up, constants become material numbers, knobs
+  become knob table columns, each shape and line carries
+  the shading mode it is drawn in, and moves, scales and
+  rotates without a knob become their matrices. Lights and
+  the ambient light apply to the whole frame, so they are
+  gathered up front. Commands that only matter before
+  drawing starts (frames, vary, constants and so on) leave
+  nothing behind.
+*/
+#define INS_PUSH 1
+#define INS_POP 2
+//multiplies the top of the stack by a matrix made ahead of time
+#define INS_TRANSFORM 3
+//move, scale or rotate by a knob's value this frame
+#define INS_MOVE 4
+#define INS_SCALE 5
+#define INS_ROTATE 6
+#define INS_DRAW 7
+#define INS_LINE 8
+#define INS_SAVE 9
+#define INS_DISPLAY 10
+
+struct instruction {
+  int code;
+  //the command in op[] it came from
+  int op;
+  //knob column of a move, scale or rotate (-1 for none)
+  //and axis of a rotate
+  int knob, axis;
+  //how a shape is drawn
+  int material, shading;
+  //amounts of a move or scale, degrees of a rotate, or the
+  //ends of a line
+  double d[6];
+  //matrix of a transform
+  struct matrix *m;
+  //file of a save
+  char *file;
+};
+
+struct program {
+  struct instruction *code;
+  int count;
+  color ambient;
+  double light[MAX_LIGHTS][2][3];
+  int lights;
+};
+
+struct program *compile_program();
+void free_program( struct program *p );
+void print_program( struct program *p );
+
+#endif
@@ -0,0 +1,213 @@
+/*====================== queue.c ========================
+Saves finished frames on their own threads, so the next
+frame can render while the last ones are encoded and
+written.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "image.h"
+#include "queue.h"
+
+int queue_depth = QUEUE_DEFAULT_DEPTH;
+
+/*======== void set_queue_depth() ==========
+Inputs:   int depth
+Returns:
+Sets how many frames can wait to be saved, 0 to save
+each one before the next starts. Exits if depth is out of
+range.
+====================*/
+void set_queue_depth( int depth ) {
+
+  if ( depth < 0 || depth > QUEUE_MAX_DEPTH ) {
+    printf("Error: Queue depth must be 0 to %d, not %d\n",
+           QUEUE_MAX_DEPTH, depth);
+    exit(1);
+  }
+  queue_depth = depth;
+}
+
+/*======== void *encode_frames() ==========
+Inputs:   void *arg
+Returns: NULL
+
+The encoder threads. Each one takes the next frame nobody
+has picked up, once it has been handed in, packs it,
+clears its screen, and saves it. Then it waits for its
+turn to pass the frame to the sink, which keeps the sink
+in frame order, and finally gives the slot back to the
+renderers.
+====================*/
+static void *encode_frames( void *arg ) {
+
+  struct frame_queue *q = (struct frame_queue *)arg;
+  struct image_buffer image = { NULL, 0, 0 };
+  struct frame_slot *slot;
+  int frame;
+
+  while ( 1 ) {
+    pthread_mutex_lock(&q->lock);
+    slot = q->slots + q->taken % q->depth;
+    while ( !slot->ready && !q->closing ) {
+      pthread_cond_wait(&q->ready, &q->lock);
+      slot = q->slots + q->taken % q->depth;
+    }
+    if ( !slot->ready ) {
+      pthread_mutex_unlock(&q->lock);
+      break;
+    }
+    slot->ready = 0;
+    frame = q->taken++;
+    pthread_mutex_unlock(&q->lock);
+
+    pack_rgb(slot->s, slot->rgb);
+    clear_screen(slot->s);
+    if ( slot->file[0] )
+      save_rgb(slot->rgb, slot->file, &image);
+
+    pthread_mutex_lock(&q->lock);
+    while ( q->sunk != frame )
+      pthread_cond_wait(&q->ordered, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+
+    //only this thread can be at frame sunk, so this is never concurrent
+    if ( q->sink != NULL )
+      q->sink(q->data, frame, slot->rgb);
+
+    pthread_mutex_lock(&q->lock);
+    q->sunk++;
+    pthread_cond_broadcast(&q->ordered);
+    pthread_cond_broadcast(&q->space);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  free_image_buffer(&image);
+  return NULL;
+}
+
+/*======== struct frame_queue *new_frame_queue() ==========
+Inputs:   int depth
+         int first
+         frame_sink sink
+         void *data
+Returns: a queue of depth cleared screens, with its encoder
+threads started
+
+first is the first frame that will be handed in, frames
+after it must follow without gaps. sink, if not NULL, is
+called with data and each packed frame, in frame order.
+There is one thread per slot, up to the number of
+processors.
+====================*/
+struct frame_queue *new_frame_queue( int depth, int first,
+                                     frame_sink sink, void *data ) {
+
+  struct frame_queue *q;
+  long cpus;
+  int i;
+
+  q = (struct frame_queue *)calloc(1, sizeof(struct frame_queue));
+  q->depth = depth;
+  q->taken = q->sunk = first;
+  q->sink = sink;
+  q->data = data;
+  q->slots = (struct frame_slot *)calloc(depth, sizeof(struct frame_slot));
+  for ( i = 0; i < depth; i++ ) {
+    q->slots[i].s = new_screen();
+    q->slots[i].rgb = (unsigned char *)malloc((size_t)xres * yres * 3);
+  }
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->ready, NULL);
+  pthread_cond_init(&q->space, NULL);
+  pthread_cond_init(&q->ordered, NULL);
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  q->thread_count = cpus > 0 && cpus < depth ? cpus : depth;
+  q->threads = (pthread_t *)malloc(q->thread_count * sizeof(pthread_t));
+  for ( i = 0; i < q->thread_count; i++ )
+    if ( pthread_create(q->threads + i, NULL, encode_frames, q) ) {
+      printf("Error: could not start encoder thread\n");
+      exit(1);
+    }
+  return q;
+}
+
+/*======== screen next_frame_screen() ==========
+Inputs:   struct frame_queue *q
+         int frame
+Returns: the screen to draw frame on, already cleared
+
+Blocks until frame is less than depth frames ahead of the
+oldest one not saved yet. Every frame must be drawn once,
+but any number of threads can be drawing them.
+====================*/
+screen next_frame_screen( struct frame_queue *q, int frame ) {
+
+  pthread_mutex_lock(&q->lock);
+  while ( frame >= q->sunk + q->depth )
+    pthread_cond_wait(&q->space, &q->lock);
+  pthread_mutex_unlock(&q->lock);
+  return q->slots[frame % q->depth].s;
+}
+
+/*======== void submit_frame() ==========
+Inputs:   struct frame_queue *q
+         int frame
+         char *file
+Returns:
+Hands the screen next_frame_screen() gave for frame back,
+to be saved to file (or only passed to the sink, if file
+is NULL).
+====================*/
+void submit_frame( struct frame_queue *q, int frame, char *file ) {
+
+  struct frame_slot *slot;
+
+  pthread_mutex_lock(&q->lock);
+  slot = q->slots + frame % q->depth;
+  if ( file != NULL )
+    snprintf(slot->file, sizeof(slot->file), "%s", file);
+  else
+    slot->file[0] = 0;
+  slot->frame = frame;
+  slot->ready = 1;
+  pthread_cond_broadcast(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/*======== void finish_frame_queue() ==========
+Inputs:   struct frame_queue *q
+Returns:
+Waits for every frame handed in to be saved, then stops
+the threads and frees q.
+====================*/
+void finish_frame_queue( struct frame_queue *q ) {
+
+  int i;
+
+  pthread_mutex_lock(&q->lock);
+  q->closing = 1;
+  pthread_cond_broadcast(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+  for ( i = 0; i < q->thread_count; i++ )
+    pthread_join(q->threads[i], NULL);
+
+  for ( i = 0; i < q->depth; i++ ) {
+    free_screen(q->slots[i].s);
+    free(q->slots[i].rgb);
+  }
+  free(q->slots);
+  free(q->threads);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->ready);
+  pthread_cond_destroy(&q->space);
+  pthread_cond_destroy(&q->ordered);
+  free(q);
+}
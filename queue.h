@@ -0,0 +1,67 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+
+#include "ml6.h"
+
+/*
+  Frames on their way out. The renderer draws each frame
+  into a screen borrowed from the queue and hands it back
+  with the file it should be saved to. Encoder threads
+  pack, encode and write it while the next frame renders,
+  then clear the screen for reuse.
+
+  queue_depth is how many frames can be rendered but not
+  yet saved. Frame n uses slot n % depth, and
+  next_frame_screen() blocks until frame n - depth is done,
+  so a slow disk holds the renderers back instead of piling
+  up frames. Frames can be drawn by several threads and
+  handed back in any order. 0 turns the queue off and every
+  frame is saved before the next one starts.
+
+  Files are saved in whatever order the threads finish
+  them, but the sink, if there is one, sees the packed
+  frames one at a time in frame order (for the animation).
+*/
+#define QUEUE_DEFAULT_DEPTH 4
+#define QUEUE_MAX_DEPTH 64
+
+typedef void (*frame_sink)( void *data, int frame, unsigned char *rgb );
+
+struct frame_slot {
+  screen s;
+  unsigned char *rgb;
+  char file[256];
+  //frame in the slot, and whether it is ready to save
+  int frame;
+  int ready;
+};
+
+struct frame_queue {
+  int depth;
+  struct frame_slot *slots;
+
+  //frames picked up by a thread, and through the sink
+  int taken, sunk;
+  int closing;
+
+  frame_sink sink;
+  void *data;
+
+  int thread_count;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t ready, space, ordered;
+};
+
+extern int queue_depth;
+
+void set_queue_depth( int depth );
+struct frame_queue *new_frame_queue( int depth, int first,
+                                     frame_sink sink, void *data );
+screen next_frame_screen( struct frame_queue *q, int frame );
+void submit_frame( struct frame_queue *q, int frame, char *file );
+void finish_frame_queue( struct frame_queue *q );
+
+#endif
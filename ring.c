@@ -0,0 +1,178 @@
+/*====================== ring.c ========================
+Publishes rendered frames to a shared memory ring, for
+local tools that want them as they finish (see ring.h for
+the layout and the consumer side).
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ring.h"
+
+char *ring_name = NULL;
+int ring_slots = RING_DEFAULT_SLOTS;
+int ring_policy = RING_OVERWRITE;
+
+/*======== void set_ring_slots() ==========
+Inputs:   int slots
+Returns:
+Sets how many frames the ring holds. Exits if slots is
+out of range.
+====================*/
+void set_ring_slots( int slots ) {
+
+  if ( slots < 1 || slots > RING_MAX_SLOTS ) {
+    printf("Error: Ring slots must be 1 to %d, not %d\n",
+           RING_MAX_SLOTS, slots);
+    exit(1);
+  }
+  ring_slots = slots;
+}
+
+/*======== void set_ring_policy() ==========
+Inputs:   char *name
+Returns:
+Picks what happens to a frame when the ring is full,
+"block", "drop" or "overwrite". Exits on anything else.
+====================*/
+void set_ring_policy( char *name ) {
+
+  if ( !strcmp(name, "block") )
+    ring_policy = RING_BLOCK;
+  else if ( !strcmp(name, "drop") )
+    ring_policy = RING_DROP;
+  else if ( !strcmp(name, "overwrite") )
+    ring_policy = RING_OVERWRITE;
+  else {
+    printf("Error: Unknown ring policy %s (block, drop or overwrite)\n", name);
+    exit(1);
+  }
+}
+
+/*======== struct ring *open_ring() ==========
+Inputs:   char *name
+         int width
+         int height
+Returns: a new, empty ring of ring_slots width x height
+frames, shared as name (kettle or /kettle both end up as
+/dev/shm/kettle)
+
+Any old segment with the same name is removed first, so
+consumers that still have it mapped don't see the new
+frames in it. The segment is left behind when mdl exits,
+so they can read the last frames; it goes away with
+rm /dev/shm/<name> or a reboot. Exits if the segment
+can't be made.
+====================*/
+struct ring *open_ring( char *name, int width, int height ) {
+
+  struct ring *r;
+  struct ring_header *h;
+  size_t header_size, frame_size, frame_stride, size;
+  char shm_name[256];
+  long page;
+  int fd;
+
+  snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+  page = sysconf(_SC_PAGESIZE);
+  header_size = (sizeof(struct ring_header) + page - 1) / page * page;
+  frame_size = (size_t)width * height * 3;
+  frame_stride = (frame_size + 63) & ~(size_t)63;
+  size = header_size + frame_stride * ring_slots;
+
+  shm_unlink(shm_name);
+  fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if ( fd < 0 || ftruncate(fd, size) < 0 ) {
+    printf("Error: could not make shared memory %s: %s\n",
+           shm_name, strerror(errno));
+    exit(1);
+  }
+  h = (struct ring_header *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+  if ( h == MAP_FAILED ) {
+    printf("Error: could not map shared memory %s: %s\n",
+           shm_name, strerror(errno));
+    exit(1);
+  }
+
+  //a new segment is all zeros, so only the layout needs filling in
+  h->version = RING_VERSION;
+  h->width = width;
+  h->height = height;
+  h->slots = ring_slots;
+  h->policy = ring_policy;
+  h->header_size = header_size;
+  h->frame_size = frame_size;
+  h->frame_stride = frame_stride;
+  //last, so a consumer that sees the magic sees the rest
+  ring_store(&h->magic, RING_MAGIC);
+
+  r = (struct ring *)malloc(sizeof(struct ring));
+  r->fd = fd;
+  r->size = size;
+  r->header = h;
+  return r;
+}
+
+/*======== void publish_frame() ==========
+Inputs:   struct ring *r
+         int frame
+         unsigned char *rgb
+Returns:
+Copies animation frame frame (packed 8 bit RGB) into the
+next slot and wakes anyone waiting for it. If the ring is
+full, ring_policy decides whether this waits for the
+consumer, drops the frame, or overwrites the oldest one.
+====================*/
+void publish_frame( struct ring *r, int frame, unsigned char *rgb ) {
+
+  struct ring_header *h = r->header;
+  struct ring_slot *slot;
+  uint32_t written, read;
+
+  written = h->written;
+  read = ring_load(&h->read);
+  while ( written - read >= h->slots ) {
+    if ( ring_policy == RING_DROP ) {
+      ring_store(&h->dropped, h->dropped + 1);
+      return;
+    }
+    if ( ring_policy == RING_OVERWRITE )
+      break;
+    ring_wait(&h->read, read);
+    read = ring_load(&h->read);
+  }
+
+  slot = h->slot + written % h->slots;
+  ring_store(&slot->sequence, slot->sequence + 1);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  memcpy(ring_pixels(h, written), rgb, h->frame_size);
+  slot->frame = frame;
+  ring_store(&slot->sequence, slot->sequence + 1);
+
+  ring_store(&h->written, written + 1);
+  ring_store(&h->events, h->events + 1);
+  ring_wake(&h->events);
+}
+
+/*======== void close_ring() ==========
+Inputs:   struct ring *r
+Returns:
+Marks the ring done, wakes any waiting consumers, and
+unmaps it.
+====================*/
+void close_ring( struct ring *r ) {
+
+  ring_store(&r->header->done, 1);
+  ring_store(&r->header->events, r->header->events + 1);
+  ring_wake(&r->header->events);
+  munmap(r->header, r->size);
+  close(r->fd);
+  free(r);
+}
@@ -0,0 +1,117 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+  Shared memory frame ring. Rendered frames are published
+  to /dev/shm/<name> (shm_open) so local tools can map them
+  and read the pixels in place, without files or copies.
+
+  The segment starts with a ring_header, then slots frames
+  of packed 8 bit RGB, the first at header_size and each
+  frame_stride bytes after the last. Frame n (counting
+  published frames, not animation frames) goes in slot
+  n % slots.
+
+  written counts frames published. Each slot has a
+  sequence number that is odd while the renderer is
+  writing to it and goes up by 2 for every frame put there,
+  so a reader can check it before and after using the
+  pixels to see if they changed under it. done is set once
+  the last frame is out.
+
+  One consumer can claim frames by setting read to how
+  many it is finished with. What the renderer does when
+  written - read reaches slots is the policy:
+  RING_BLOCK     - wait for the consumer to catch up
+  RING_DROP      - skip the new frame
+  RING_OVERWRITE - write it anyway, over the oldest one
+                   (the default, so the renderer never
+                   waits on a consumer that isn't there)
+
+  events goes up after every frame and once more when the
+  renderer is done, so a consumer that found nothing new
+  sleeps with ring_wait(&h->events, e), e being events as
+  read before it looked. The renderer sleeps on read when
+  it blocks, so a consumer should ring_wake(&h->read) after
+  moving it. The inline functions below are everything a
+  consumer needs, so this header can be used on its own.
+*/
+#define RING_MAGIC 0x474e4952
+#define RING_VERSION 1
+
+#define RING_BLOCK 0
+#define RING_DROP 1
+#define RING_OVERWRITE 2
+
+#define RING_DEFAULT_SLOTS 8
+#define RING_MAX_SLOTS 64
+
+struct ring_slot {
+  uint32_t sequence;
+  //animation frame in the slot
+  uint32_t frame;
+};
+
+struct ring_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width, height;
+  uint32_t slots;
+  uint32_t policy;
+  uint64_t header_size;
+  uint64_t frame_size;
+  uint64_t frame_stride;
+
+  uint32_t events;
+  uint32_t written;
+  uint32_t read;
+  uint32_t dropped;
+  uint32_t done;
+
+  struct ring_slot slot[RING_MAX_SLOTS];
+};
+
+static inline unsigned char *ring_pixels( struct ring_header *h, uint32_t n ) {
+  return (unsigned char *)h + h->header_size + (n % h->slots) * h->frame_stride;
+}
+
+static inline uint32_t ring_load( uint32_t *p ) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_store( uint32_t *p, uint32_t v ) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+//sleeps while *p is still v
+static inline void ring_wait( uint32_t *p, uint32_t v ) {
+  syscall(SYS_futex, p, FUTEX_WAIT, v, NULL, NULL, 0);
+}
+
+static inline void ring_wake( uint32_t *p ) {
+  syscall(SYS_futex, p, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+struct ring {
+  int fd;
+  size_t size;
+  struct ring_header *header;
+};
+
+extern char *ring_name;
+extern int ring_slots;
+extern int ring_policy;
+
+void set_ring_slots( int slots );
+void set_ring_policy( char *name );
+struct ring *open_ring( char *name, int width, int height );
+void publish_frame( struct ring *r, int frame, unsigned char *rgb );
+void close_ring( struct ring *r );
+
+#endif
@@ -0,0 +1,152 @@
+/*====================== stream.c ========================
+Streams finished frames as raw video, so an encoder like
+ffmpeg can read them straight from a pipe while the rest
+render.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "display.h"
+#include "stream.h"
+
+char *stream_target = NULL;
+int stream_format = STREAM_Y4M;
+
+//the real stdout once take_stdout() has moved it, -1 before
+static int stdout_fd = -1;
+
+/*======== void set_stream_format() ==========
+Inputs:   char *name
+Returns:
+Picks the stream format, "y4m" or "rgb". Exits on anything
+else.
+====================*/
+void set_stream_format( char *name ) {
+
+  if ( !strcmp(name, "y4m") )
+    stream_format = STREAM_Y4M;
+  else if ( !strcmp(name, "rgb") )
+    stream_format = STREAM_RGB;
+  else {
+    printf("Error: Unknown stream format %s (y4m or rgb)\n", name);
+    exit(1);
+  }
+}
+
+/*======== void take_stdout() ==========
+Inputs:
+Returns:
+Keeps stdout for the stream and points it at stderr, so
+everything printed from then on stays out of the stream.
+Called as soon as - is given as the stream target, before
+the script is parsed and anything else is printed. Exits
+if stdout can't be kept.
+====================*/
+void take_stdout() {
+
+  if ( stdout_fd >= 0 )
+    return;
+  fflush(stdout);
+  stdout_fd = dup(STDOUT_FILENO);
+  if ( stdout_fd < 0 ) {
+    printf("Error: could not keep stdout: %s\n", strerror(errno));
+    exit(1);
+  }
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+/*======== struct stream *open_stream() ==========
+Inputs:   char *target
+         int width
+         int height
+Returns: a stream of width x height frames to target
+
+target is a file or named pipe (opening a pipe waits for
+its reader), or - for stdout, which take_stdout() should
+already have taken so only frames end up in it. The y4m
+header is written here. Exits if target can't be opened.
+====================*/
+struct stream *open_stream( char *target, int width, int height ) {
+
+  struct stream *st;
+  char header[128];
+  int fd, size;
+
+  if ( !strcmp(target, "-") ) {
+    take_stdout();
+    fd = stdout_fd;
+  }
+  else
+    fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 ) {
+    printf("Error: could not open %s: %s\n", target, strerror(errno));
+    exit(1);
+  }
+
+  st = (struct stream *)malloc(sizeof(struct stream));
+  st->fd = fd;
+  st->width = width;
+  st->height = height;
+  st->yuv = NULL;
+  if ( stream_format == STREAM_Y4M ) {
+    size = sprintf(header, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+                   width, height, STREAM_RATE_NUM, STREAM_RATE_DEN);
+    write_all(fd, (unsigned char *)header, size);
+    st->yuv = (unsigned char *)malloc(6 + (size_t)width * height * 3);
+    memcpy(st->yuv, "FRAME\n", 6);
+  }
+  return st;
+}
+
+/*======== void write_stream_frame() ==========
+Inputs:   struct stream *st
+         unsigned char *rgb
+Returns:
+Writes the next frame, packed 8 bit RGB. For y4m it is
+converted to studio range BT.601 YUV with the usual 8 bit
+fixed point weights, and written with its FRAME line in a
+single write.
+====================*/
+void write_stream_frame( struct stream *st, unsigned char *rgb ) {
+
+  unsigned char *y, *u, *v;
+  int r, g, b;
+  size_t i, n;
+
+  n = (size_t)st->width * st->height;
+  if ( stream_format == STREAM_RGB ) {
+    write_all(st->fd, rgb, n * 3);
+    return;
+  }
+
+  y = st->yuv + 6;
+  u = y + n;
+  v = u + n;
+  for ( i = 0; i < n; i++, rgb+= 3 ) {
+    r = rgb[0];
+    g = rgb[1];
+    b = rgb[2];
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  write_all(st->fd, st->yuv, 6 + n * 3);
+}
+
+/*======== void close_stream() ==========
+Inputs:   struct stream *st
+Returns:
+Closes the stream, which tells its reader there are no
+more frames, and frees st.
+====================*/
+void close_stream( struct stream *st ) {
+
+  close(st->fd);
+  free(st->yuv);
+  free(st);
+}
@@ -0,0 +1,41 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+/*
+  Frames streamed to a file, a named pipe, or stdout (-) as
+  they finish, for ffmpeg or anything else that reads raw
+  video, instead of being saved one file per frame.
+  STREAM_Y4M - YUV4MPEG2, a single header with the size and
+               frame rate, then each frame as full resolution
+               (4:4:4) BT.601 Y, U and V planes
+  STREAM_RGB - nothing but the packed 8 bit RGB pixels, one
+               frame after another (ffmpeg's rgb24)
+
+  The frame rate matches the GIF, 100 / 3 frames a second.
+  stream_target is where the frames go, NULL to save them
+  to files as usual.
+  Streaming to stdout moves everything else printed over
+  to stderr, from the moment - is read off the command line.
+*/
+#define STREAM_Y4M 0
+#define STREAM_RGB 1
+
+#define STREAM_RATE_NUM 100
+#define STREAM_RATE_DEN 3
+
+struct stream {
+  int fd;
+  int width, height;
+  unsigned char *yuv;
+};
+
+extern char *stream_target;
+extern int stream_format;
+
+void set_stream_format( char *name );
+void take_stdout();
+struct stream *open_stream( char *target, int width, int height );
+void write_stream_frame( struct stream *st, unsigned char *rgb );
+void close_stream( struct stream *st );
+
+#endif
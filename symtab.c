@@ -6,8 +6,21 @@
 #include "symtab.h"
 #include "matrix.h"
 
-SYMTAB symtab[MAX_SYMBOLS];
+SYMTAB **symtab = NULL;
 int lastsym = 0;
+int lastknob = 0;
+
+//room in symtab, a whole number of blocks
+static int symtab_size = 0;
+
+//the hash table: each bucket is the index of a symbol in
+//symtab plus one, or 0 when free. Its size is a power of 2
+static int *buckets = NULL;
+static int bucket_count = 0;
+
+//the rest of the string pool block names go in
+static char *names = NULL;
+static size_t names_left = 0;
 
 
 void print_constants(struct constants *p)
@@ -23,6 +36,8 @@ void print_constants(struct constants *p)
 
   printf("Red - %6.2f\tGreen - %6.2f\tBlue - %6.2f\n",
          p->red,p->green,p->blue);
+
+  printf("Specular exponent - %6.2f\n", p->specular_exp);
 }
 
 
@@ -41,55 +56,138 @@ void print_symtab()
   int i;
   for (i=0; i < lastsym;i++)
     {
-      printf("Name: %s\n",symtab[i].name);
-      switch (symtab[i].type)
+      printf("Name: %s\n",symtab[i]->name);
+      switch (symtab[i]->type)
         {
         case SYM_MATRIX:
           printf("Type: SYM_MATRIX\n");
-          print_matrix(symtab[i].s.m);
+          print_matrix(symtab[i]->s.m);
           break;
         case SYM_CONSTANTS:
           printf("Type: SYM_CONSTANTS\n");
-          print_constants(symtab[i].s.c);
+          print_constants(symtab[i]->s.c);
           break;
         case SYM_LIGHT:
           printf("Type: SYM_LIGHT\n");
-          print_light(symtab[i].s.l);
+          print_light(symtab[i]->s.l);
           break;
         case SYM_VALUE:
           printf("Type: SYM_VALUE\n");
-          printf("value: %6.2f\n", symtab[i].s.value);
+          printf("value: %6.2f\n", symtab[i]->s.value);
           break;
         case SYM_FILE:
           printf("Type: SYM_VALUE\n");
-          printf("Name: %s\n",symtab[i].name);
+          printf("Name: %s\n",symtab[i]->name);
         }
       printf("\n");
     }
 }
 
-SYMTAB *add_symbol(char *name, int type, void *data)
+//FNV-1a hash of a name
+static unsigned int hash_name(char *name)
 {
-  SYMTAB *t;
+  unsigned int h = 2166136261u;
+
+  while (*name)
+    {
+      h ^= (unsigned char)*name++;
+      h *= 16777619u;
+    }
+  return h;
+}
 
-  t = (SYMTAB *)lookup_symbol(name);
-  if (t==NULL)
+//the bucket name is in, or the free one it would go in
+static int find_bucket(char *name)
+{
+  int i, mask;
+
+  mask = bucket_count - 1;
+  for (i = hash_name(name) & mask; buckets[i]; i = (i + 1) & mask)
     {
-      if (lastsym >= MAX_SYMBOLS)
+      if (!strcmp(name, symtab[buckets[i] - 1]->name))
         {
-          return NULL;
+          break;
         }
-      t = (SYMTAB *)&(symtab[lastsym]);
-      lastsym++;
     }
-  else
+  return i;
+}
+
+//doubles the hash table and puts every symbol back in it
+static void grow_buckets()
+{
+  int i;
+
+  free(buckets);
+  bucket_count = bucket_count ? bucket_count * 2 : SYMTAB_BUCKETS;
+  buckets = (int *)calloc(bucket_count, sizeof(int));
+  for (i=0; i < lastsym; i++)
     {
-      return t;
+      buckets[find_bucket(symtab[i]->name)] = i + 1;
     }
+}
+
+//copies name into the string pool, names are only ever
+//copied once, when their symbol is added
+static char *intern_name(char *name)
+{
+  size_t size;
+  char *p;
 
-  t->name = (char *)malloc(strlen(name)+1);
-  strcpy(t->name,name);
+  size = strlen(name) + 1;
+  if (size > names_left)
+    {
+      names_left = size > NAME_BLOCK ? size : NAME_BLOCK;
+      names = (char *)malloc(names_left);
+    }
+  p = names;
+  memcpy(p, name, size);
+  names += size;
+  names_left -= size;
+  return p;
+}
+
+//the next free symbol, making another block of them if
+//they're all used
+static SYMTAB *new_symbol()
+{
+  SYMTAB *block;
+  int i;
+
+  if (lastsym == symtab_size)
+    {
+      block = (SYMTAB *)calloc(SYMTAB_BLOCK, sizeof(SYMTAB));
+      symtab = (SYMTAB **)realloc(symtab, (symtab_size + SYMTAB_BLOCK) *
+                                  sizeof(SYMTAB *));
+      for (i=0; i < SYMTAB_BLOCK; i++)
+        {
+          symtab[symtab_size + i] = block + i;
+        }
+      symtab_size += SYMTAB_BLOCK;
+    }
+  return symtab[lastsym++];
+}
+
+SYMTAB *add_symbol(char *name, int type, void *data)
+{
+  SYMTAB *t;
+  int b;
+
+  //at most half full keeps the probes short
+  if ((lastsym + 1) * 2 > bucket_count)
+    {
+      grow_buckets();
+    }
+  b = find_bucket(name);
+  if (buckets[b])
+    {
+      return symtab[buckets[b] - 1];
+    }
+  t = new_symbol();
+  buckets[b] = lastsym;
+
+  t->name = intern_name(name);
   t->type = type;
+  t->knob = -1;
   switch (type)
     {
     case SYM_CONSTANTS:
@@ -107,21 +205,33 @@ SYMTAB *add_symbol(char *name, int type, void *data)
     case SYM_FILE:
       break;
     }
-  return (SYMTAB *)&(symtab[lastsym-1]);
+  return t;
+}
+
+
+//like add_symbol, for a knob, which also gets the next
+//column of the knob table the first time it is seen
+SYMTAB *add_knob(char *name)
+{
+  SYMTAB *t;
+
+  t = add_symbol(name, SYM_VALUE, 0);
+  if (t->knob < 0)
+    t->knob = lastknob++;
+  return t;
 }
 
 
 SYMTAB *lookup_symbol(char *name)
 {
-  int i;
-  for (i=0;i<lastsym;i++)
+  int b;
+
+  if (bucket_count == 0)
     {
-      if (!strcmp(name,symtab[i].name))
-        {
-          return (SYMTAB *) &(symtab[i]);
-        }
+      return (SYMTAB *)NULL;
     }
-  return (SYMTAB *)NULL;
+  b = find_bucket(name);
+  return buckets[b] ? symtab[buckets[b] - 1] : (SYMTAB *)NULL;
 }
 
 void set_value(SYMTAB *p, double value)
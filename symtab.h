@@ -1,7 +1,6 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
-#define MAX_SYMBOLS 512
 #define SYM_MATRIX 1
 #define SYM_VALUE 2
 #define SYM_CONSTANTS 3
@@ -15,6 +14,8 @@ struct constants
   double g[4];
   double b[4];
   double red,green,blue;
+  double specular_exp;
+  int material;
 };
 
 struct light
@@ -27,6 +28,8 @@ typedef struct
 {
   char *name;
   int type;
+  //column in the knob table, -1 if it isn't a knob
+  int knob;
   union{
     struct matrix *m;
     struct constants *c;
@@ -35,8 +38,23 @@ typedef struct
   } s;
 } SYMTAB;
 
-extern SYMTAB symtab[MAX_SYMBOLS];
+/*
+  Symbols live in blocks of SYMTAB_BLOCK that never move, so
+  a SYMTAB pointer stays good however many are added after
+  it. symtab points to each one, in the order they were
+  added. They are found by name through an open addressing
+  hash table with linear probing, kept at most half full by
+  doubling it (from SYMTAB_BUCKETS). Names are interned:
+  each is copied once into a pool of NAME_BLOCK byte
+  blocks, and that copy is the symbol's name.
+*/
+#define SYMTAB_BLOCK 256
+#define SYMTAB_BUCKETS 64
+#define NAME_BLOCK 4096
+
+extern SYMTAB **symtab;
 extern int lastsym;
+extern int lastknob;
 
 SYMTAB *lookup_symbol(char *name);
 SYMTAB *add_symbol(char *name, int type, void *data);
@@ -44,6 +62,7 @@ void print_constants(struct constants *p);
 void print_light(struct light *p);
 void print_symtab();
 SYMTAB *add_symbol(char *name, int type, void *data);
+SYMTAB *add_knob(char *name);
 void set_value(SYMTAB *p, double value);
 
 